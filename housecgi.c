@@ -39,7 +39,19 @@
 #include "houselog.h"
 #include "houselog_sensor.h"
 
+#include "housecgi_breaker.h"
+#include "housecgi_git.h"
+#include "housecgi_json.h"
+#include "housecgi_store.h"
+#include "housecgi_usage.h"
 #include "housecgi_route.h"
+#include "housecgi_schedule.h"
+#include "housecgi_sensor.h"
+#include "housecgi_spool.h"
+#include "housecgi_stat.h"
+#include "housecgi_trace.h"
+#include "housecgi_warmup.h"
+#include "housecgi_worker.h"
 
 static int Debug = 0;
 static char HostName[256] = {0};
@@ -49,18 +61,67 @@ static char HostName[256] = {0};
 static const char *housecgi_status (const char *method, const char *uri,
                                     const char *data, int length) {
 
-    static char buffer[65537];
-    int cursor;
+    // A dashboard that polls periodically can ask only for the
+    // applications that changed since its previous poll.
+    time_t since = 0;
+    const char *value = echttp_parameter_get ("since");
+    if (value) since = (time_t)atoll (value);
 
-    cursor = snprintf (buffer, sizeof(buffer),
-                       "{\"host\":\"%s\",\"timestamp\":%lld,\"cgi\":{",
+    housecgi_json_start ();
+    housecgi_json_add ("{\"host\":\"%s\",\"timestamp\":%lld,",
                        HostName, (long long)time(0));
+    if (since) housecgi_json_add ("\"since\":%lld,", (long long)since);
+    housecgi_json_add ("\"cgi\":{");
+
+    housecgi_route_status (since);
+    housecgi_json_status (",", housecgi_worker_status);
+    housecgi_json_status (",", housecgi_worker_children_status);
+    housecgi_json_status (",", housecgi_schedule_status);
+    housecgi_json_status (",", housecgi_git_status);
+    housecgi_json_status (",", housecgi_store_status);
+    housecgi_json_status (",", housecgi_spool_status);
+    housecgi_json_status (",", housecgi_usage_status);
+
+    housecgi_json_add ("}}");
+    echttp_content_type_json ();
+    return housecgi_json_end ();
+}
 
-    cursor += housecgi_route_status (buffer+cursor, sizeof(buffer)-cursor);
+// The administrative actions change the state of housecgi: these are
+// not allowed with GET, so that a link or a crawler cannot trigger them.
+//
+static int housecgi_admin_denied (const char *method) {
+    if (!strcmp (method, "POST")) return 0;
+    echttp_attribute_set ("Allow", "POST");
+    echttp_error (405, "Method Not Allowed");
+    return 1;
+}
 
-    snprintf (buffer+cursor, sizeof(buffer)-cursor, "}}");
-    echttp_content_type_json ();
-    return buffer;
+static const char *housecgi_kill (const char *method, const char *uri,
+                                  const char *data, int length) {
+
+    if (housecgi_admin_denied (method)) return "";
+
+    const char *pid = echttp_parameter_get ("pid");
+    if ((!pid) || (housecgi_worker_kill (atoi (pid)) < 0)) {
+        echttp_error (404, "No such CGI child");
+        return "";
+    }
+    return housecgi_status (method, uri, data, length);
+}
+
+static const char *housecgi_drain (const char *method, const char *uri,
+                                   const char *data, int length) {
+
+    if (housecgi_admin_denied (method)) return "";
+
+    const char *app = echttp_parameter_get ("app");
+    int drain = (strstr (uri, "/resume") == 0);
+    if ((!app) || (housecgi_worker_drain (app, drain) < 0)) {
+        echttp_error (404, "No such CGI application");
+        return "";
+    }
+    return housecgi_status (method, uri, data, length);
 }
 
 static void housecgi_background (int fd, int mode) {
@@ -72,10 +133,13 @@ static void housecgi_background (int fd, int mode) {
     LastCall = now;
 
     housecgi_route_background (now);
+    housecgi_warmup_background (now);
+    housecgi_worker_background (now);
 
-    houseportal_background (now);
+    if (housecgi_worker_primary()) houseportal_background (now);
     housediscover (now);
     houselog_background (now);
+    housecgi_sensor_background (now);
     houselog_sensor_background (now);
 }
 
@@ -106,15 +170,41 @@ int main (int argc, const char **argv) {
     echttp_default ("-http-service=dynamic");
     argc = echttp_open (argc, argv);
 
+    housecgi_stat_initialize (instance); // Shared by the workers.
+    housecgi_schedule_initialize (argc, argv);
+    housecgi_breaker_initialize (argc, argv);
+    housecgi_warmup_initialize (argc, argv); // Shared probe token.
+    housecgi_worker_initialize (argc, argv); // Must be done first.
+
     houseportal_initialize (argc, argv);
     housediscover_initialize (argc, argv);
     houselog_initialize (instance, argc, argv);
+    housecgi_sensor_initialize (instance, argc, argv);
 
+    housecgi_trace_initialize (instance, argc, argv);
     housecgi_route_initialize (instance, argc, argv); // Declare the CGI routes.
 
     static char uri[128];
     snprintf (uri, sizeof(uri), "/%s/status", instance);
     echttp_route_uri (uri, housecgi_status);
+
+    // Administrative actions.
+    char admin[128];
+    snprintf (admin, sizeof(admin), "/%s/kill", instance);
+    echttp_route_uri (strdup (admin), housecgi_kill);
+    snprintf (admin, sizeof(admin), "/%s/drain", instance);
+    echttp_route_uri (strdup (admin), housecgi_drain);
+    snprintf (admin, sizeof(admin), "/%s/resume", instance);
+    echttp_route_uri (strdup (admin), housecgi_drain);
+
+    // Each cgi-bin directory may be registered as a different service.
+    const char *service;
+    for (i = 0; (service = housecgi_route_service (i)); ++i) {
+        if (!strcmp (service, instance)) continue;
+        char serviceuri[128];
+        snprintf (serviceuri, sizeof(serviceuri), "/%s/status", service);
+        echttp_route_uri (strdup (serviceuri), housecgi_status);
+    }
     echttp_static_route ("/", "/usr/local/share/house/public");
     echttp_background (&housecgi_background);
     echttp_loop();
@@ -0,0 +1,276 @@
+/* HouseCGI - A simple home web service to support CGI applications.
+ *
+ * Copyright 2025, Pascal Martin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ * housecgi_breaker.c - Stop launching CGI applications that keep failing.
+ *
+ * This module implements a circuit breaker for each CGI application. An
+ * execution fails when the CGI times out, crashes, exits with an error
+ * code, produces no output or returns a 5xx status (e.g. 502 or 504).
+ * After too many consecutive failures (option -cgi-breaker=N, default 5,
+ * 0 to disable), the breaker opens: the requests are rejected immediately,
+ * without launching the CGI, for a cool-down period (option
+ * -cgi-cooldown=N seconds, default 30). After that, one trial request at
+ * a time is let through: if it succeeds the breaker closes, otherwise
+ * it opens again, for twice the previous cool-down period (up to 16 times
+ * the configured period).
+ *
+ * The threshold can also be set per application, using the "breaker=N"
+ * application option.
+ *
+ * The breaker state is shared by all workers.
+ *
+ * void housecgi_breaker_initialize (int argc, const char **argv);
+ *
+ *    Initialize this module. This must be called before the workers
+ *    are forked.
+ *
+ * void housecgi_breaker_declare (int app, const char *name);
+ *
+ *    Load the breaker options for the specified application.
+ *
+ * int  housecgi_breaker_enter (int app);
+ *
+ *    Return 0 if the application may be launched, or else the number of
+ *    seconds until the next trial.
+ *
+ * void housecgi_breaker_leave (int app, int failed);
+ *
+ *    Record the outcome of an execution allowed by housecgi_breaker_enter().
+ *
+ * void housecgi_breaker_cancel (int app);
+ *
+ *    The execution allowed by housecgi_breaker_enter() did not happen.
+ *
+ * int  housecgi_breaker_app_status (int app, char *buffer, int size);
+ *
+ *    Return the breaker state for one application, as JSON fields
+ *    meant to be inserted in the application's object. The text starts
+ *    with a comma.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "echttp.h"
+#include "houselog.h"
+
+#include "housecgi_breaker.h"
+#include "housecgi_option.h"
+#include "housecgi_stat.h"
+
+#define BREAKER_CLOSED 0
+#define BREAKER_OPEN   1
+#define BREAKER_TRIAL  2
+
+static const char *CgiBreakerStateName[] = {"closed", "open", "trial"};
+
+typedef struct {
+    int    state;
+    int    threshold;
+    int    failures;  // Consecutive failures.
+    int    cooldown;  // Current cool-down period.
+    time_t until;     // End of the cool-down (open), or of the trial.
+    int    trial;     // A trial request is executing.
+    long long trips;
+    long long rejected;
+} CgiBreakerApp;
+
+typedef struct {
+    int32_t lock;
+    CgiBreakerApp app[HOUSECGI_APPS_MAX];
+} CgiBreakerShared;
+
+static CgiBreakerShared *CgiBreaker = 0;
+static HouseCgiStat *CgiStat = 0;
+
+static int CgiBreakerThreshold = 5;
+static int CgiBreakerCooldown = 30;
+
+static void housecgi_breaker_lock (void) {
+    housecgi_stat_lock (&(CgiBreaker->lock));
+}
+
+static void housecgi_breaker_unlock (void) {
+    housecgi_stat_unlock (&(CgiBreaker->lock));
+}
+
+void housecgi_breaker_initialize (int argc, const char **argv) {
+
+    int i;
+    const char *value;
+    for (i = 1; i < argc; ++i) {
+        if (echttp_option_match ("-cgi-breaker=", argv[i], &value)) {
+            CgiBreakerThreshold = atoi (value);
+            if (CgiBreakerThreshold < 0) CgiBreakerThreshold = 0;
+        } else if (echttp_option_match ("-cgi-cooldown=", argv[i], &value)) {
+            CgiBreakerCooldown = atoi (value);
+            if (CgiBreakerCooldown < 1) CgiBreakerCooldown = 1;
+        }
+    }
+
+    CgiBreaker = mmap (0, sizeof(CgiBreakerShared), PROT_READ|PROT_WRITE,
+                       MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if (CgiBreaker == MAP_FAILED) {
+        fprintf (stderr, "Cannot allocate shared memory\n");
+        exit (1);
+    }
+    for (i = 0; i < HOUSECGI_APPS_MAX; ++i) {
+        CgiBreaker->app[i].threshold = CgiBreakerThreshold;
+        CgiBreaker->app[i].cooldown = CgiBreakerCooldown;
+    }
+    CgiStat = housecgi_stat_initialize (0); // Normally already done.
+}
+
+void housecgi_breaker_declare (int app, const char *name) {
+
+    if ((app < 0) || (app >= HOUSECGI_APPS_MAX)) return;
+
+    int threshold = housecgi_option_integer (name, "breaker",
+                                             CgiBreakerThreshold);
+    if (threshold < 0) threshold = 0;
+
+    housecgi_breaker_lock ();
+    CgiBreaker->app[app].threshold = threshold;
+    housecgi_breaker_unlock ();
+}
+
+int housecgi_breaker_enter (int app) {
+
+    if ((app < 0) || (app >= HOUSECGI_APPS_MAX)) return 0;
+
+    CgiBreakerApp *breaker = CgiBreaker->app + app;
+    if (breaker->state == BREAKER_CLOSED) return 0; // Fast path, no lock.
+
+    int wait = 0;
+    time_t now = time(0);
+
+    housecgi_breaker_lock ();
+    switch (breaker->state) {
+    case BREAKER_OPEN:
+        if (now < breaker->until) {
+            wait = (int)(breaker->until - now);
+            break;
+        }
+        breaker->state = BREAKER_TRIAL;
+        // Fall through.
+    case BREAKER_TRIAL:
+        // Only one trial at a time. A trial that lasts for too long was
+        // probably abandoned, e.g. its worker died.
+        if (breaker->trial && (now < breaker->until)) {
+            wait = (int)(breaker->until - now);
+            break;
+        }
+        breaker->trial = 1;
+        breaker->until = now + breaker->cooldown;
+        break;
+    }
+    if (wait > 0) breaker->rejected += 1;
+    housecgi_breaker_unlock ();
+    return wait;
+}
+
+void housecgi_breaker_leave (int app, int failed) {
+
+    if ((app < 0) || (app >= HOUSECGI_APPS_MAX)) return;
+
+    CgiBreakerApp *breaker = CgiBreaker->app + app;
+    if ((!failed) && (breaker->state == BREAKER_CLOSED) &&
+        (breaker->failures == 0)) return; // Fast path, no lock.
+
+    int tripped = 0;
+    int recovered = 0;
+    time_t now = time(0);
+
+    housecgi_breaker_lock ();
+    if (!failed) {
+        breaker->failures = 0;
+        if (breaker->state != BREAKER_CLOSED) {
+            breaker->state = BREAKER_CLOSED;
+            breaker->trial = 0;
+            breaker->cooldown = CgiBreakerCooldown;
+            recovered = 1;
+        }
+    } else {
+        breaker->failures += 1;
+        if (breaker->state == BREAKER_TRIAL) {
+            // Still failing: wait longer before the next trial.
+            breaker->trial = 0;
+            breaker->cooldown *= 2;
+            if (breaker->cooldown > 16 * CgiBreakerCooldown)
+                breaker->cooldown = 16 * CgiBreakerCooldown;
+            breaker->state = BREAKER_OPEN;
+            breaker->until = now + breaker->cooldown;
+        } else if ((breaker->state == BREAKER_CLOSED) &&
+                   (breaker->threshold > 0) &&
+                   (breaker->failures >= breaker->threshold)) {
+            breaker->state = BREAKER_OPEN;
+            breaker->until = now + breaker->cooldown;
+            breaker->trips += 1;
+            tripped = 1;
+        }
+    }
+    int failures = breaker->failures;
+    housecgi_breaker_unlock ();
+
+    if (tripped) {
+        houselog_event ("CGI", CgiStat->app[app].name, "BROKEN",
+                        "AFTER %d CONSECUTIVE FAILURES", failures);
+    } else if (recovered) {
+        houselog_event ("CGI", CgiStat->app[app].name, "RECOVERED", "");
+    }
+}
+
+void housecgi_breaker_cancel (int app) {
+
+    if ((app < 0) || (app >= HOUSECGI_APPS_MAX)) return;
+
+    CgiBreakerApp *breaker = CgiBreaker->app + app;
+    if (breaker->state == BREAKER_CLOSED) return;
+
+    housecgi_breaker_lock ();
+    if (breaker->state == BREAKER_TRIAL) breaker->trial = 0;
+    housecgi_breaker_unlock ();
+}
+
+int housecgi_breaker_app_status (int app, char *buffer, int size) {
+
+    if ((app < 0) || (app >= HOUSECGI_APPS_MAX)) return 0;
+
+    const CgiBreakerApp *breaker = CgiBreaker->app + app;
+    int cursor = snprintf (buffer, size,
+                           ",\"breaker\":{\"state\":\"%s\",\"failures\":%d"
+                               ",\"trips\":%lld,\"rejected\":%lld",
+                           CgiBreakerStateName[breaker->state],
+                           breaker->failures,
+                           breaker->trips, breaker->rejected);
+    if (cursor >= size) return 0;
+    if (breaker->state != BREAKER_CLOSED) {
+        cursor += snprintf (buffer+cursor, size-cursor,
+                            ",\"until\":%lld", (long long)breaker->until);
+        if (cursor >= size) return 0;
+    }
+    cursor += snprintf (buffer+cursor, size-cursor, "}");
+    if (cursor >= size) return 0;
+    return cursor;
+}
@@ -0,0 +1,216 @@
+/* HouseCGI - A simple home web service to support CGI applications.
+ *
+ * Copyright 2025, Pascal Martin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ * housecgi_capture.c - Capture the CGI requests for a later replay.
+ *
+ * This module appends each CGI request, with the status, size and latency
+ * of its response, to a binary capture file (option -cgi-capture=PATH).
+ * The capture can later be replayed using the housecgireplay tool.
+ *
+ * The request body is stored only if its size is not larger than the
+ * -cgi-capture-body=N option (default 65536, 0 means never): a digest of
+ * the body is always recorded.
+ *
+ * void housecgi_capture_initialize (int argc, const char **argv);
+ *
+ *    Initialize this module. The capture is disabled unless the
+ *    -cgi-capture option is present.
+ *
+ * void housecgi_capture_start (void);
+ *
+ *    Start a new request. This records the start time and resets the
+ *    response status to 200.
+ *
+ * void housecgi_capture_status (int status);
+ * int  housecgi_capture_result (void);
+ *
+ *    Record, or return, the HTTP status of the response to the current
+ *    request. The status is tracked even when not capturing.
+ *
+ * void housecgi_capture_record (const char *method, const char *uri,
+ *                               const char *data, int length, int size);
+ *
+ *    Append the current request to the capture file. The size is the
+ *    length of the response content.
+ *
+ * NOTE
+ *
+ *    Like the trace, the capture relies on CGI requests being executed one
+ *    at a time: there is only one current request per worker. All workers
+ *    append to the same file, with one write per record.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "echttp.h"
+
+#include "housecgi_capture.h"
+
+// The HTTP attributes that are captured. Credentials (Cookie,
+// Authorization) are intentionally not captured.
+//
+static const char *CgiCaptureAttributes[] = {
+    "Content-Type",
+    "Content-Encoding",
+    "Accept",
+    "Accept-Encoding",
+    "Git-Protocol",
+    "If-Modified-Since",
+    "If-None-Match",
+    "Range",
+    "Referer",
+    "User-Agent",
+    0
+};
+
+static int CgiCaptureFile = -1;
+static int CgiCaptureBody = 65536;
+
+static struct timeval CgiCaptureStart;
+static int CgiCaptureStatus = 200;
+
+static char *CgiCaptureBuffer = 0;
+static int   CgiCaptureSize = 0;
+
+void housecgi_capture_initialize (int argc, const char **argv) {
+
+    int i;
+    const char *value;
+    const char *path = 0;
+    for (i = 1; i < argc; ++i) {
+        if (echttp_option_match ("-cgi-capture=", argv[i], &value)) {
+            path = value;
+        } else if (echttp_option_match ("-cgi-capture-body=", argv[i], &value)) {
+            CgiCaptureBody = atoi (value);
+            if (CgiCaptureBody < 0) CgiCaptureBody = 0;
+        }
+    }
+    if (!path) return;
+
+    CgiCaptureFile =
+        open (path, O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC, 0600);
+    if (CgiCaptureFile < 0) {
+        fprintf (stderr, "Cannot open capture file %s\n", path);
+    }
+}
+
+void housecgi_capture_start (void) {
+    CgiCaptureStatus = 200;
+    if (CgiCaptureFile < 0) return;
+    gettimeofday (&CgiCaptureStart, 0);
+}
+
+void housecgi_capture_status (int status) {
+    CgiCaptureStatus = status;
+}
+
+int housecgi_capture_result (void) {
+    return CgiCaptureStatus;
+}
+
+static uint64_t housecgi_capture_digest (const char *data, int length) {
+    uint64_t hash = 14695981039346656037ULL; // FNV-1a.
+    int i;
+    for (i = 0; i < length; ++i) {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static int housecgi_capture_string (int cursor, const char *text) {
+
+    int length = strlen (text);
+    if (length > 0xffff) length = 0xffff;
+
+    uint16_t encoded = (uint16_t)length;
+    memcpy (CgiCaptureBuffer + cursor, &encoded, sizeof(encoded));
+    memcpy (CgiCaptureBuffer + cursor + sizeof(encoded), text, length);
+    return cursor + sizeof(encoded) + length;
+}
+
+void housecgi_capture_record (const char *method, const char *uri,
+                              const char *data, int length, int size) {
+
+    if (CgiCaptureFile < 0) return;
+
+    struct timeval now;
+    gettimeofday (&now, 0);
+
+    char query[1024];
+    echttp_parameter_join (query, sizeof(query));
+
+    const char *values[sizeof(CgiCaptureAttributes)/sizeof(char *)];
+    int needed = sizeof(HouseCgiCaptureRecord);
+    needed += strlen(method) + strlen(uri) + strlen(query) + 6;
+
+    int i;
+    for (i = 0; CgiCaptureAttributes[i]; ++i) {
+        values[i] = echttp_attribute_get (CgiCaptureAttributes[i]);
+        if (!values[i]) continue;
+        needed += strlen(CgiCaptureAttributes[i]) + strlen(values[i]) + 4;
+    }
+    if (length < 0) length = 0;
+    int stored = (length <= CgiCaptureBody) ? length : 0;
+    needed += stored;
+
+    if (needed > CgiCaptureSize) {
+        CgiCaptureSize = needed + 4096;
+        CgiCaptureBuffer = realloc (CgiCaptureBuffer, CgiCaptureSize);
+    }
+
+    HouseCgiCaptureRecord record;
+    memset (&record, 0, sizeof(record));
+    record.magic = HOUSECGI_CAPTURE_MAGIC;
+    record.timestamp =
+        ((int64_t)CgiCaptureStart.tv_sec * 1000000) + CgiCaptureStart.tv_usec;
+    record.latency = (uint32_t)
+        (((int64_t)now.tv_sec * 1000000) + now.tv_usec - record.timestamp);
+    record.response = (size > 0) ? size : 0;
+    record.status = CgiCaptureStatus;
+    record.length = length;
+    record.digest = housecgi_capture_digest (data, length);
+    record.stored = stored;
+
+    int cursor = sizeof(record);
+    cursor = housecgi_capture_string (cursor, method);
+    cursor = housecgi_capture_string (cursor, uri);
+    cursor = housecgi_capture_string (cursor, query);
+    record.strings = 3;
+    for (i = 0; CgiCaptureAttributes[i]; ++i) {
+        if (!values[i]) continue;
+        cursor = housecgi_capture_string (cursor, CgiCaptureAttributes[i]);
+        cursor = housecgi_capture_string (cursor, values[i]);
+        record.strings += 2;
+    }
+    if (stored > 0) {
+        memcpy (CgiCaptureBuffer + cursor, data, stored);
+        cursor += stored;
+    }
+    record.size = cursor;
+    memcpy (CgiCaptureBuffer, &record, sizeof(record));
+
+    write (CgiCaptureFile, CgiCaptureBuffer, cursor);
+}
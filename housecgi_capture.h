@@ -0,0 +1,54 @@
+/* HouseCGI - A simple home web service to support CGI applications.
+ *
+ * Copyright 2025, Pascal Martin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ * housecgi_capture.h - Capture the CGI requests for a later replay.
+ *
+ * The capture file is a sequence of records, each made of a fixed header
+ * followed by a list of strings and then, optionally, the request body.
+ * Each string is a 16 bit length followed by the characters, without
+ * null terminator. The strings are: method, URI, query, and then pairs
+ * of HTTP attribute name and value. All integers are in the host's byte
+ * order: a capture is meant to be replayed on the same architecture.
+ */
+
+#include <stdint.h>
+
+#define HOUSECGI_CAPTURE_MAGIC 0x31494743 // "CGI1"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t size;      // Total size of the record, including this header.
+    int64_t  timestamp; // Request received, microseconds since epoch.
+    uint32_t latency;   // Microseconds.
+    uint32_t response;  // Size of the response content.
+    uint16_t status;
+    uint16_t strings;   // Number of strings following this header.
+    uint32_t length;    // Length of the request body.
+    uint64_t digest;    // FNV-1a hash of the request body.
+    uint32_t stored;    // Length of the request body stored (0 or length).
+    uint32_t reserved;
+} HouseCgiCaptureRecord;
+
+void housecgi_capture_initialize (int argc, const char **argv);
+
+void housecgi_capture_start (void);
+void housecgi_capture_status (int status);
+int  housecgi_capture_result (void);
+void housecgi_capture_record (const char *method, const char *uri,
+                              const char *data, int length, int size);
@@ -0,0 +1,88 @@
+/* HouseCGI - A simple home web service to support CGI applications.
+ *
+ * Copyright 2025, Pascal Martin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ * housecgi_client.c - Detect when the HTTP client went away.
+ *
+ * The socket of the current request is provided by echttp. A worker
+ * processes one request at a time, so this is the socket of the client
+ * waiting for the CGI output.
+ *
+ * A client is considered gone when its connection was reset. A client
+ * that closed its side of the connection may only have shut down its
+ * output after sending the request, and is still waiting for the response:
+ * this is considered gone only with the -cgi-cancel-on-close option, e.g.
+ * when the clients are known to never do this (web browsers, git).
+ *
+ * This detection is disabled by the -cgi-no-cancel option.
+ *
+ * void housecgi_client_initialize (int argc, const char **argv);
+ *
+ *    Initialize this module.
+ *
+ * int  housecgi_client_socket (void);
+ *
+ *    Return the socket of the current HTTP request, or -1 if unknown.
+ *
+ * int  housecgi_client_gone (int fd);
+ *
+ *    Return 1 if the client of the specified socket went away.
+ */
+
+#define _GNU_SOURCE
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "echttp.h"
+
+#include "housecgi_client.h"
+
+static int CgiClientEnabled = 1;
+static int CgiClientOnClose = 0;
+
+void housecgi_client_initialize (int argc, const char **argv) {
+
+    int i;
+    for (i = 1; i < argc; ++i) {
+        if (echttp_option_present ("-cgi-no-cancel", argv[i])) {
+            CgiClientEnabled = 0;
+        } else if (echttp_option_present ("-cgi-cancel-on-close", argv[i])) {
+            CgiClientOnClose = 1;
+        }
+    }
+}
+
+int housecgi_client_socket (void) {
+    if (!CgiClientEnabled) return -1;
+    return echttp_client_socket ();
+}
+
+int housecgi_client_gone (int fd) {
+
+    if (fd < 0) return 0;
+
+    struct pollfd watch;
+    watch.fd = fd;
+    watch.events = CgiClientOnClose ? POLLRDHUP : 0;
+    watch.revents = 0;
+    if (poll (&watch, 1, 0) <= 0) return 0;
+    return (watch.revents & (POLLRDHUP|POLLHUP|POLLERR|POLLNVAL)) != 0;
+}
@@ -23,7 +23,14 @@
  *
  * void housecgi_execute_initialize (int argc, const char **argv);
  *
- *    Initialize this module.
+ *    Initialize this module. A CGI process that runs for more than
+ *    -cgi-timeout=N seconds (default 5) is killed, together with any
+ *    process it started. This can be changed for one application
+ *    using its "timeout=N" option.
+ *
+ *    The output of a CGI process is limited to HOUSECGI_OUTPUT_MAX bytes,
+ *    because echttp handles sizes as int. A CGI process that outputs more
+ *    is killed, and the request fails with a 502 status.
  *
  * int housecgi_execute_declare (const char *name, const char *uri,
  *                               const char *path, const char *root);
@@ -34,6 +41,33 @@
  *    This function returns an ID that can be used when running the CGI
  *    application.
  *
+ * void housecgi_execute_variables (const char *script, const char *root,
+ *                                  const char *method, const char *uri,
+ *                                  housecgi_execute_setter *set);
+ *
+ *    Build the standard CGI variables for the current echttp request and
+ *    pass each one to the set function. This is used to populate the
+ *    environment of the CGI child, but also by other gateway protocols.
+ *
+ * int housecgi_execute_header (char *data, int length);
+ *
+ *    Decode the CGI header at the start of data, and set the matching HTTP
+ *    attributes for the current echttp request. The data is modified in
+ *    place and must remain valid until the response has been sent.
+ *    Return the offset of the content that follows the header, or -1
+ *    if the end of the header (a blank line) was not found.
+ *
+ * int housecgi_execute_user (int id, const char *user);
+ *
+ *    Run this CGI application as the specified user. This requires
+ *    housecgi to run as root, or with the CAP_SETUID and CAP_SETGID
+ *    capabilities. Return 0 on success, -1 if the user is not known.
+ *
+ * void housecgi_execute_priority (int id, int priority);
+ *
+ *    Apply the specified priority options (see housecgi_priority.c) to
+ *    each child of this CGI application, or none if priority is -1.
+ *
  * void housecgi_execute_launch (int id,
  *                               const char *method, const char *uri,
  *                               const char *data, int length);
@@ -47,6 +81,14 @@
  *    wait (blocking or non blocking) for CGI output and/or termination.
  *    Returns 1 if the CGI process did exit, 0 otherwise.
  *
+ * void housecgi_execute_cancel (int id);
+ *
+ *    Terminate the running CGI process, and any process it started,
+ *    because nobody will receive its output: send SIGTERM now, and SIGKILL
+ *    one second later if still running. This does not wait: the process
+ *    is collected by housecgi_execute_wait() or housecgi_execute_background(),
+ *    as usual. The CGI output is discarded.
+ *
  * const char *housecgi_execute_output (int id);
  *
  *    Return the output of a (recently deceased) CGI. The returned pointer
@@ -56,10 +98,59 @@
  *    provided by the CGI application has been decoded and set as HTTP
  *    attributes for this request, including the content type.
  *
+ *    If the application has the "memfd" option, the CGI output was written
+ *    to a memory file instead of a pipe. In that case the content is not
+ *    returned, it is transferred by echttp directly from that file, using
+ *    sendfile(). This avoids copying large outputs through the heap.
+ *
+ * char *housecgi_execute_copy (int id, int limit, int *length);
+ *
+ *    Return a copy of the complete CGI output, header included, if its
+ *    size is not above the limit. This must be called before the output
+ *    is retrieved. The copy is allocated and must be freed by the caller.
+ *    Return 0 if the output is too large, or was already partially
+ *    transferred to echttp.
+ *
+ * int housecgi_execute_save (int id, int fd, int limit);
+ *
+ *    Write the complete CGI output, header included, to the specified file,
+ *    if its size is not above the limit. This must be called before
+ *    the output is retrieved. Return the size written, or -1 on failure.
+ *    This is only practical for large outputs when the application has
+ *    the "memfd" option.
+ *
+ * int housecgi_execute_size (int id);
+ *
+ *    Return the size of the last CGI output received. While the CGI
+ *    is running, this is the size of the output received so far.
+ *
+ * int housecgi_execute_pid (int id);
+ *
+ *    Return the process ID of the running CGI child, or 0.
+ *
+ * int housecgi_execute_content (int id);
+ *
+ *    Return the size of the content of the last CGI response, i.e. the
+ *    CGI output without its header.
+ *
+ * int housecgi_execute_timedout (int id);
+ *
+ *    Return 1 if the last CGI execution was killed because it took too long.
+ *
+ * int housecgi_execute_cancelled (int id);
+ *
+ *    Return 1 if the last CGI execution was cancelled.
+ *
  * int housecgi_execute_max (int id);
  *
  *    Return the size of the largest CGI output received so far.
  *
+ * const struct rusage *housecgi_execute_usage (int id);
+ * int housecgi_execute_exit (int id);
+ *
+ *    Return the resources used by the last CGI child, and its exit
+ *    status (in the wait4() format), as collected when it was reaped.
+ *
  * void housecgi_execute_background (time_t now);
  *
  *    Monitor the running CGI subprocesses.
@@ -89,14 +180,23 @@
  *      - A pipe is not compatible with sendfile(). Use splice() in that case?
  */
 
+#define _GNU_SOURCE
 #include <fcntl.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <grp.h>
+#include <poll.h>
+#include <pwd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 #include <time.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 
 #include "echttp.h"
@@ -106,6 +206,10 @@
 
 #include "housecgi_route.h"
 #include "housecgi_execute.h"
+#include "housecgi_capture.h"
+#include "housecgi_option.h"
+#include "housecgi_priority.h"
+#include "housecgi_trace.h"
 
 typedef struct {
     char *name;
@@ -113,9 +217,17 @@ typedef struct {
     char *uri;
     char *executable;
     char *root;
+    char *user;
+    char *home;
+    uid_t uid;
+    gid_t gid;
+    int   priority;
     pid_t running;
     time_t launched;
+    int   timeout;
     int   timedout;
+    int   toolarge;
+    time_t cancelled; // 0 if not cancelled.
     int   write;
     int   read;
     char  out[0x10000];
@@ -124,6 +236,13 @@ typedef struct {
     int   overflowlen;
     int   outtotal;
     int   outmax;
+    int   content;
+    int   buffered;
+    int   file;
+    char *mapped;
+    int   mappedlen;
+    int   exitstatus;
+    struct rusage usage;
 } CgiChild;
 
 static CgiChild *CgiChildren = 0;
@@ -131,6 +250,8 @@ static CgiChild *CgiChildren = 0;
 static int CgiChildrenCount = 0;
 static int CgiChildrenSize = 0;
 
+static int CgiExecuteTimeout = 5;
+
 static char HostName[128] = {0};
 
 static int housecgi_execute_search (const char *name) {
@@ -145,13 +266,16 @@ static int housecgi_execute_search (const char *name) {
     return -1;
 }
 
-static void housecgi_execute_env (int i, const char *method, const char *uri) {
+void housecgi_execute_variables (const char *script, const char *root,
+                                 const char *method, const char *uri,
+                                 housecgi_execute_setter *set) {
 
     // Set the CGI environment variables:
     // AUTH_TYPE (not supported)
     // CONTENT_LENGTH (Content-Length attribute).
     // CONTENT_TYPE (Content-Type attribute)
     // GATEWAY_INTERFACE (CGI/1.1)
+    // GIT_PROTOCOL (Git-Protocol attribute, for git-http-backend)
     // HTTP_COOKIE (Cookies attribute)
     // HTTP_HOST (host name)
     // HTTP_REFERER (Referer attribute)
@@ -172,73 +296,125 @@ static void housecgi_execute_env (int i, const char *method, const char *uri) {
     const char *attribute;
 
     attribute = echttp_attribute_get ("Content-Length");
-    if (attribute) setenv ("CONTENT_LENGTH", attribute, 1);
+    if (attribute) set ("CONTENT_LENGTH", attribute);
     attribute = echttp_attribute_get ("Content-Type");
-    if (attribute) setenv ("CONTENT_TYPE", attribute, 1);
+    if (attribute) set ("CONTENT_TYPE", attribute);
 
-    setenv ("GATEWAY_INTERFACE", "CGI/1.1", 1);
+    set ("GATEWAY_INTERFACE", "CGI/1.1");
 
+    attribute = echttp_attribute_get ("Git-Protocol");
+    if (attribute) set ("GIT_PROTOCOL", attribute);
     attribute = echttp_attribute_get ("Cookie");
-    if (attribute) setenv ("HTTP_COOKIE", attribute, 1);
+    if (attribute) set ("HTTP_COOKIE", attribute);
     attribute = echttp_attribute_get ("Referer");
-    if (attribute) setenv ("HTTP_REFERER", attribute, 1);
+    if (attribute) set ("HTTP_REFERER", attribute);
     attribute = echttp_attribute_get ("User-Agent");
-    if (attribute) setenv ("HTTP_USER_AGENT", attribute, 1);
+    if (attribute) set ("HTTP_USER_AGENT", attribute);
 
     char query[1024];
     echttp_parameter_join (query, sizeof(query));
-    setenv ("QUERY_STRING", query, 1);
+    set ("QUERY_STRING", query);
 
     if (!HostName[0]) gethostname (HostName, sizeof(HostName)-1);
-    setenv ("HTTP_HOST", HostName, 1);
-    setenv ("SERVER_NAME", HostName, 1);
+    set ("HTTP_HOST", HostName);
+    set ("SERVER_NAME", HostName);
 
-    setenv ("REDIRECT_STATUS", "200", 1); // For now..
+    set ("REDIRECT_STATUS", "200"); // For now..
 
-    setenv ("REQUEST_METHOD", method, 1);
+    set ("REQUEST_METHOD", method);
 
-    const char *path_info = uri + strlen(CgiChildren[i].uri);
-    setenv ("PATH_INFO", path_info, 1);
+    const char *path_info = uri + strlen(script);
+    set ("PATH_INFO", path_info);
 
     char translated[1024];
     snprintf (translated, sizeof(translated),
-              "%s%s", CgiChildren[i].root, path_info);
-    setenv ("PATH_TRANSLATED", translated, 1);
+              "%s%s", root, path_info);
+    set ("PATH_TRANSLATED", translated);
+
+    set ("SCRIPT_NAME", script);
 
-    setenv ("SCRIPT_NAME", CgiChildren[i].uri, 1);
+    set ("SERVER_PORT", "80");
+    set ("SERVER_PROTOCOL", "HTTP/1.1");
+    set ("SERVER_SOFTWARE", "housecgi/0.1"); // For now
+}
+
+static void housecgi_execute_setenv (const char *name, const char *value) {
+    setenv (name, value, 1);
+}
 
-    setenv ("SERVER_PORT", "80", 1);
-    setenv ("SERVER_PROTOCOL", "HTTP/1.1", 1);
-    setenv ("SERVER_SOFTWARE", "housecgi/0.1", 1); // For now
+static int housecgi_execute_tmpfile (void) {
+    int fd = memfd_create ("housecgi", MFD_CLOEXEC);
+    if (fd < 0) fd = open ("/tmp", O_TMPFILE|O_RDWR|O_CLOEXEC, 0600);
+    return fd;
 }
 
 static pid_t housecgi_execute_fork (int i) {
 
     int read_pipe[2];
     int write_pipe[2];
+    int file = -1;
     pid_t child;
 
-    if (pipe (read_pipe) < 0) return -1;
-    if (pipe (write_pipe) < 0) return -1;
+    if (pipe2 (read_pipe, O_CLOEXEC) < 0) return -1;
+    if (pipe2 (write_pipe, O_CLOEXEC) < 0) {
+        close (read_pipe[0]);
+        close (read_pipe[1]);
+        return -1;
+    }
+    if (CgiChildren[i].buffered) {
+        file = housecgi_execute_tmpfile ();
+        if (file < 0) {
+            close (read_pipe[0]);
+            close (read_pipe[1]);
+            close (write_pipe[0]);
+            close (write_pipe[1]);
+            return -1;
+        }
+    }
 
     child = fork();
     if (child == 0) {
-        // This is the child process.
+        // This is the child process. It gets its own process group, so that
+        // its own children can be terminated with it.
+        setpgid (0, 0);
         dup2 (write_pipe[0], 0);
-        dup2 (read_pipe[1], 1);
+        if (file >= 0) {
+            dup2 (file, 1);
+            // The pipe is only used to detect when the child terminates.
+            fcntl (read_pipe[1], F_SETFD, 0);
+        } else {
+            dup2 (read_pipe[1], 1);
+        }
         chdir (CgiChildren[i].root);
     } else {
         // This is the parent process.
+        close (read_pipe[1]);
+        close (write_pipe[0]);
+        if (child < 0) {
+            close (read_pipe[0]);
+            close (write_pipe[1]);
+            if (file >= 0) close (file);
+            return child;
+        }
+        setpgid (child, child); // In case the child did not do it yet.
         CgiChildren[i].running = child;
         CgiChildren[i].launched = time (0);
         CgiChildren[i].timedout = 0;
+        CgiChildren[i].toolarge = 0;
+        CgiChildren[i].cancelled = 0;
+        CgiChildren[i].exitstatus = 0;
+        memset (&(CgiChildren[i].usage), 0, sizeof(CgiChildren[i].usage));
         CgiChildren[i].read = read_pipe[0];
         CgiChildren[i].write = write_pipe[1];
+        CgiChildren[i].file = file;
         CgiChildren[i].outlen = 0;
         CgiChildren[i].outtotal = 0;
+        CgiChildren[i].content = 0;
         if (CgiChildren[i].overflow) free (CgiChildren[i].overflow);
         CgiChildren[i].overflow = 0;
         CgiChildren[i].overflowlen = 0;
+        housecgi_trace_mark (HOUSECGI_TRACE_LAUNCH);
+        housecgi_trace_pid (child);
     }
     return child;
 }
@@ -260,7 +436,15 @@ static void housecgi_execute_listen (int i, int blocking) {
         timeout.tv_sec = blocking ? 1 : 0;
 
         int result = select (CgiChildren[i].read+1, &reads, 0, 0, &timeout);
-        if ((result > 0) && FD_ISSET(CgiChildren[i].read, &reads)) {
+        if ((result > 0) && FD_ISSET(CgiChildren[i].read, &reads) &&
+            CgiChildren[i].cancelled) {
+            // Nobody will receive this output: drop it.
+            char discard[4096];
+            if (read (CgiChildren[i].read, discard, sizeof(discard)) <= 0) {
+                close (CgiChildren[i].read);
+                CgiChildren[i].read = -1;
+            }
+        } else if ((result > 0) && FD_ISSET(CgiChildren[i].read, &reads)) {
             char *buffer;
             int use_overflow = 0;
             int space = sizeof(CgiChildren[i].out) - CgiChildren[i].outlen - 1;
@@ -295,28 +479,35 @@ static void housecgi_execute_listen (int i, int blocking) {
             }
             int length = read (CgiChildren[i].read, buffer, space);
             if (length > 0) {
+               housecgi_trace_mark (HOUSECGI_TRACE_FIRSTBYTE);
                if (use_overflow)
                    CgiChildren[i].overflowlen += length;
                else
                    CgiChildren[i].outlen += length;
                CgiChildren[i].outtotal += length;
+               if (CgiChildren[i].outtotal > HOUSECGI_OUTPUT_MAX) {
+                   // Stop listening, and kill this CGI (see below).
+                   CgiChildren[i].toolarge = 1;
+                   close (CgiChildren[i].read);
+                   CgiChildren[i].read = -1;
+               }
+            } else if (length == 0) {
+                // End of output: no need to listen anymore.
+                close (CgiChildren[i].read);
+                CgiChildren[i].read = -1;
             }
         }
+    } else if (blocking) {
+        poll (0, 0, 10); // Just wait for the child to terminate.
     }
 }
 
-static int housecgi_execute_deceased (int i) {
-
-    if (CgiChildren[i].running <= 0) return 1;
-
-    if (CgiChildren[i].launched + 5 < time(0)) {
-        // Time to kill this rogue CGI process.
-        kill (CgiChildren[i].running, SIGSEGV);
-        CgiChildren[i].timedout = 1;
-    }
+static int housecgi_execute_reap (int i, int options) {
 
-    pid_t pid = waitpid (CgiChildren[i].running, 0, WNOHANG);
+    pid_t pid = wait4 (CgiChildren[i].running, &(CgiChildren[i].exitstatus),
+                       options, &(CgiChildren[i].usage));
     if (pid == CgiChildren[i].running) {
+        housecgi_trace_mark (HOUSECGI_TRACE_EXIT);
         CgiChildren[i].running = 0;
         if (CgiChildren[i].read > 0) close (CgiChildren[i].read);
         if (CgiChildren[i].write > 0) close (CgiChildren[i].write);
@@ -326,6 +517,30 @@ static int housecgi_execute_deceased (int i) {
     return 0;
 }
 
+static int housecgi_execute_deceased (int i) {
+
+    if (CgiChildren[i].running <= 0) return 1;
+
+    if (CgiChildren[i].launched + CgiChildren[i].timeout < time(0)) {
+        // Time to kill this rogue CGI process, and any process it started.
+        kill (-CgiChildren[i].running, SIGSEGV);
+        CgiChildren[i].timedout = 1;
+    }
+
+    if ((!CgiChildren[i].toolarge) && (CgiChildren[i].file >= 0)) {
+        struct stat filestat;
+        if ((fstat (CgiChildren[i].file, &filestat) == 0) &&
+            (filestat.st_size > HOUSECGI_OUTPUT_MAX))
+            CgiChildren[i].toolarge = 1;
+    }
+    if (CgiChildren[i].toolarge) kill (-CgiChildren[i].running, SIGKILL);
+
+    if (CgiChildren[i].cancelled && (CgiChildren[i].cancelled < time(0)))
+        kill (-CgiChildren[i].running, SIGKILL); // SIGTERM was not enough.
+
+    return housecgi_execute_reap (i, WNOHANG);
+}
+
 static void housecgi_execute_cleanup (int id) {
 
     if (CgiChildren[id].overflow) {
@@ -333,9 +548,27 @@ static void housecgi_execute_cleanup (int id) {
         CgiChildren[id].overflow = 0;
     }
     CgiChildren[id].overflowlen = 0;
+
+    if (CgiChildren[id].mapped) {
+        munmap (CgiChildren[id].mapped, CgiChildren[id].mappedlen);
+        CgiChildren[id].mapped = 0;
+    }
+    if (CgiChildren[id].file >= 0) {
+        close (CgiChildren[id].file);
+        CgiChildren[id].file = -1;
+    }
 }
 
 void housecgi_execute_initialize (int argc, const char **argv) {
+
+    int i;
+    const char *value;
+    for (i = 1; i < argc; ++i) {
+        if (echttp_option_match ("-cgi-timeout=", argv[i], &value)) {
+            CgiExecuteTimeout = atoi (value);
+            if (CgiExecuteTimeout < 1) CgiExecuteTimeout = 1;
+        }
+    }
 }
 
 int housecgi_execute_declare (const char *name, const char *uri,
@@ -351,24 +584,80 @@ int housecgi_execute_declare (const char *name, const char *uri,
                                    CgiChildrenSize*sizeof(CgiChild));
         }
         i = CgiChildrenCount++;
+        memset (CgiChildren+i, 0, sizeof(CgiChild));
         CgiChildren[i].name = strdup(name);
         CgiChildren[i].signature = echttp_hash_signature (name);
+        CgiChildren[i].read = CgiChildren[i].write = -1;
+        CgiChildren[i].file = -1;
+        CgiChildren[i].priority = -1;
     } else {
         // update an existing entry.
         if (CgiChildren[i].executable) free (CgiChildren[i].executable);
         if (CgiChildren[i].uri) free (CgiChildren[i].uri);
         if (CgiChildren[i].root) free (CgiChildren[i].root);
         if (CgiChildren[i].overflow) free (CgiChildren[i].overflow);
+        if (CgiChildren[i].user) free (CgiChildren[i].user);
+        if (CgiChildren[i].home) free (CgiChildren[i].home);
+        CgiChildren[i].user = CgiChildren[i].home = 0;
     }
     CgiChildren[i].executable = strdup (path);
     CgiChildren[i].uri = strdup (uri);
     CgiChildren[i].root = strdup (root);
     CgiChildren[i].overflow = 0;
     CgiChildren[i].overflowlen = 0;
+    CgiChildren[i].timeout =
+        housecgi_option_integer (name, "timeout", CgiExecuteTimeout);
+    if (CgiChildren[i].timeout < 1) CgiChildren[i].timeout = 1;
+    CgiChildren[i].buffered = (housecgi_option_get (name, "memfd") != 0) ||
+                              (housecgi_option_get (name, "spool") != 0);
 
     return i;
 }
 
+int housecgi_execute_user (int id, const char *user) {
+
+    if ((id < 0) || (id >= CgiChildrenCount)) return -1;
+
+    struct passwd *account = getpwnam (user);
+    if (!account) return -1;
+
+    CgiChild *child = CgiChildren + id;
+    if (child->user) free (child->user);
+    if (child->home) free (child->home);
+    child->user = strdup (user);
+    child->home = strdup (account->pw_dir);
+    child->uid = account->pw_uid;
+    child->gid = account->pw_gid;
+    return 0;
+}
+
+void housecgi_execute_priority (int id, int priority) {
+
+    if ((id < 0) || (id >= CgiChildrenCount)) return;
+    CgiChildren[id].priority = priority;
+}
+
+// Set the identity of the CGI child process. This never returns
+// if the child cannot run as the requested user.
+//
+static void housecgi_execute_identity (const CgiChild *child) {
+
+#ifdef PR_CAP_AMBIENT
+    // Never pass the capabilities used to switch user to a CGI application.
+    prctl (PR_CAP_AMBIENT, PR_CAP_AMBIENT_CLEAR_ALL, 0, 0, 0);
+#endif
+    if ((!child->user) || (child->uid == getuid())) return;
+
+    if (initgroups (child->user, child->gid) ||
+        setgid (child->gid) || setuid (child->uid)) {
+        fprintf (stderr, "Cannot run %s as user %s\n", child->name, child->user);
+        exit (1);
+    }
+    setenv ("HOME", child->home, 1);
+    setenv ("USER", child->user, 1);
+    setenv ("LOGNAME", child->user, 1);
+}
+
 void housecgi_execute_launch (int id,
                               const char *method, const char *uri,
                               const char *data, int length) {
@@ -389,15 +678,24 @@ void housecgi_execute_launch (int id,
     if (child < 0) return; // Failure.
 
     if (child == 0) {
-        // This is the child process.
-        housecgi_execute_env (id, method, uri);
+        // This is the child process. Raising the priority may require
+        // privileges that are dropped when switching user.
+        housecgi_priority_apply (CgiChildren[id].priority);
+        housecgi_execute_identity (CgiChildren + id);
+        housecgi_execute_variables (CgiChildren[id].uri, CgiChildren[id].root,
+                                    method, uri, housecgi_execute_setenv);
         execlp (CgiChildren[id].executable, CgiChildren[id].name, (char *)0);
         // This should never return: failed to launch the CGI executable.
         exit(1);
     }
 
-    if (length > 0)
+    if (length > 0) {
         write (CgiChildren[id].write, data, length); // FIXME: blocking!!
+        housecgi_trace_mark (HOUSECGI_TRACE_STDIN);
+    }
+    // The whole request body was sent: let the CGI application see EOF.
+    close (CgiChildren[id].write);
+    CgiChildren[id].write = -1;
 }
 
 int housecgi_execute_wait (int id, int blocking) {
@@ -420,6 +718,67 @@ static char *housecgi_execute_split (char *line) {
    return cursor;
 }
 
+static void housecgi_execute_attribute (const char *name, const char *value) {
+
+    if (!strcasecmp (name, "Location")) {
+        echttp_redirect (value);
+        housecgi_capture_status (302);
+    } else if (!strcasecmp (name, "Status")) {
+        int status = atoi(value);
+        if (status != 200) {
+            const char *reason = "CGI status";
+            const char *sep = strchr (value, ' ');
+            if (sep) reason = sep + 1;
+            if ((status < 100) || (status > 599)) {
+                status = 502;
+                reason = "CGI invalid response";
+            }
+            echttp_error (status, reason);
+            housecgi_capture_status (status);
+        }
+    } else if ((!strcasecmp (name, "Content-Length")) ||
+               (!strcasecmp (name, "Transfer-Encoding")) ||
+               (!strcasecmp (name, "Connection")) ||
+               (!strcasecmp (name, "Keep-Alive"))) {
+        return; // These are handled by echttp.
+    } else {
+        echttp_attribute_set (name, value);
+    }
+}
+
+int housecgi_execute_header (char *data, int length) {
+
+    // Accept the following EOL sequences only: CR LF, LF. (Sorry, Apple.)
+    char *line = data;
+    char *cursor;
+    char *end = data + length;
+    for (cursor = data; cursor < end; ++cursor) {
+        if (*cursor == '\r') {
+            *cursor = 0; // Exterminate!
+        } else if (*cursor == '\n') {
+            *cursor = 0;
+            if (*line == 0) return (cursor - data) + 1; // Blank line.
+            char *value = housecgi_execute_split (line);
+            if (value) housecgi_execute_attribute (line, value);
+            line = cursor + 1;
+        }
+    }
+    return -1; // No end of header: not a valid CGI output.
+}
+
+void housecgi_execute_cancel (int id) {
+
+    if ((id < 0) || (id >= CgiChildrenCount)) return; // Invalid CGI?
+
+    CgiChild *child = CgiChildren + id;
+    if (child->running <= 0) return;
+
+    if (child->cancelled) return; // Already done.
+
+    kill (-(child->running), SIGTERM);
+    child->cancelled = time(0);
+}
+
 static const char *housecgi_execute_error (int code, const char *text) {
 
     static char message[1024];
@@ -428,9 +787,46 @@ static const char *housecgi_execute_error (int code, const char *text) {
               "<html><body>Sorry, your request failed: %s</body></html>", text);
     echttp_content_type_html ();
     echttp_error (code, text);
+    housecgi_capture_status (code);
     return message;
 }
 
+static const char *housecgi_execute_file (int id) {
+
+    // The CGI output was written to a file: decode the header from
+    // a private mapping of the beginning of the file, and let echttp
+    // transfer the rest directly from the file.
+    //
+    CgiChild *child = CgiChildren + id;
+    int length = child->outtotal;
+    if (length > sizeof(child->out) - 1) length = sizeof(child->out) - 1;
+
+    char *header = mmap (0, length, PROT_READ|PROT_WRITE, MAP_PRIVATE,
+                         child->file, 0);
+    if (header == MAP_FAILED) {
+        length = pread (child->file, child->out, length, 0);
+        if (length <= 0) return housecgi_execute_error (502, "No CGI output");
+        header = child->out;
+    } else {
+        child->mapped = header;
+        child->mappedlen = length;
+    }
+    int body = housecgi_execute_header (header, length);
+    housecgi_trace_mark (HOUSECGI_TRACE_HEADER);
+    if (body < 0) {
+        housecgi_execute_cleanup (id);
+        return housecgi_execute_error (502, "Invalid CGI header");
+    }
+
+    length = child->outtotal - body;
+    if (length <= 0) return ""; // No data left.
+    child->content = length;
+    lseek (child->file, body, SEEK_SET);
+    echttp_transfer (child->file, length);
+    child->file = -1; // Now owned by echttp.
+    return "";
+}
+
 const char *housecgi_execute_output (int id) {
 
     if ((id < 0) || (id >= CgiChildrenCount)) // Invalid CGI?
@@ -438,6 +834,28 @@ const char *housecgi_execute_output (int id) {
 
     if (CgiChildren[id].running > 0) return 0; // Not complete yet.
 
+    if (CgiChildren[id].cancelled) {
+        CgiChildren[id].outlen = 0;
+        CgiChildren[id].outtotal = 0;
+        housecgi_execute_cleanup (id);
+        return housecgi_execute_error (499, "Client closed request");
+    }
+
+    if (CgiChildren[id].file >= 0) {
+        struct stat filestat;
+        if (fstat (CgiChildren[id].file, &filestat) == 0) {
+            if (filestat.st_size > HOUSECGI_OUTPUT_MAX)
+                CgiChildren[id].toolarge = 1;
+            else
+                CgiChildren[id].outtotal = (int)filestat.st_size;
+        }
+    }
+
+    if (CgiChildren[id].toolarge) {
+        housecgi_execute_cleanup (id);
+        return housecgi_execute_error (502, "CGI output too large");
+    }
+
     if (CgiChildren[id].outtotal <= 0)
         return housecgi_execute_error (502, "No CGI output");
 
@@ -446,8 +864,25 @@ const char *housecgi_execute_output (int id) {
         return housecgi_execute_error (504, "CGI timeout");;
     }
 
+    if (CgiChildren[id].file >= 0) {
+        if (CgiChildren[id].outtotal > CgiChildren[id].outmax)
+            CgiChildren[id].outmax = CgiChildren[id].outtotal;
+        return housecgi_execute_file (id);
+    }
+
+    // The header must be complete before any content is sent.
+    int length = CgiChildren[id].outlen;
+    char *output = CgiChildren[id].out;
+    output[length] = 0; // Null terminated.
+    int body = housecgi_execute_header (output, length);
+    housecgi_trace_mark (HOUSECGI_TRACE_HEADER);
+    if (body < 0) {
+        housecgi_execute_cleanup (id);
+        return housecgi_execute_error (502, "Invalid CGI header");
+    }
+
     // Flush out any leftover output.
-    if (CgiChildren[id].overflow) {
+    if (CgiChildren[id].overflowlen > 0) {
         echttp_content_queue (CgiChildren[id].overflow,
                               CgiChildren[id].overflowlen);
         CgiChildren[id].overflow = 0;
@@ -457,45 +892,107 @@ const char *housecgi_execute_output (int id) {
     if (CgiChildren[id].outtotal > CgiChildren[id].outmax)
         CgiChildren[id].outmax = CgiChildren[id].outtotal;
 
-    // Extract the header attributes.
-    // Accept the following EOL sequences only: CR LF, LF. (Sorry, Apple.)
-    int i;
-    int length = CgiChildren[id].outlen;
-    char *output = CgiChildren[id].out;
-    char *line = output;
-    output[length] = 0; // Null terminated.
-    for (i = 1; i < length; ++i) {
-        output += 1;
-        if (*output == '\r') *output = 0; // Exterminate!
-        else if (*output == '\n') {
-            // Blank line = end of header.
-            if ((*line == 0) || (*line == '\n')) break;
-            *output = 0;
-            char *value = housecgi_execute_split (line);
-            if (!strcmp (value, "Location")) {
-                echttp_redirect (value);
-            } else if (!strcmp (value, "Status")) {
-                if (strcmp (value, "200")) {
-                   const char *reason = "CGI status";
-                   int status = atoi(value);
-                   const char *sep = strchr (value, ' ');
-                   if (sep) reason = sep + 1;
-                   if ((status < 100) || (status > 599)) {
-                       status = 502;
-                       reason = "CGI invalid response";
-                   }
-                   echttp_error (status, reason);
-                }
-            } else {
-                echttp_attribute_set (line, value);
-            }
-            line = output + 1;
-        }
-    }
-    length -= (i + 1);
+    length -= body;
     if (length <= 0) return ""; // No data left.
+    CgiChildren[id].content = length;
     echttp_content_length (length); // The CGI output might be binary.
-    return output + 1; // Skip the last new line.
+    return output + body;
+}
+
+char *housecgi_execute_copy (int id, int limit, int *length) {
+
+    if ((id < 0) || (id >= CgiChildrenCount)) return 0;
+    CgiChild *child = CgiChildren + id;
+    if (child->running > 0) return 0; // Not complete yet.
+
+    int size = child->outtotal;
+    if (child->file >= 0) {
+        struct stat filestat;
+        if (fstat (child->file, &filestat)) return 0;
+        if (filestat.st_size > limit) return 0;
+        size = (int)filestat.st_size;
+    } else if (child->outlen + child->overflowlen != size) {
+        return 0; // Some data was already queued.
+    }
+    if ((size <= 0) || (size > limit)) return 0;
+
+    char *copy = malloc (size);
+    if (child->file >= 0) {
+        if (pread (child->file, copy, size, 0) != size) {
+            free (copy);
+            return 0;
+        }
+    } else {
+        memcpy (copy, child->out, child->outlen);
+        if (child->overflowlen > 0)
+            memcpy (copy + child->outlen, child->overflow, child->overflowlen);
+    }
+    *length = size;
+    return copy;
+}
+
+int housecgi_execute_save (int id, int fd, int limit) {
+
+    if ((id < 0) || (id >= CgiChildrenCount)) return -1;
+    CgiChild *child = CgiChildren + id;
+    if (child->running > 0) return -1; // Not complete yet.
+
+    if (child->file < 0) {
+        // Only possible if no data was queued to echttp yet.
+        int length;
+        char *copy = housecgi_execute_copy (id, limit, &length);
+        if (!copy) return -1;
+        int written = write (fd, copy, length);
+        free (copy);
+        return (written == length) ? length : -1;
+    }
+
+    struct stat filestat;
+    if (fstat (child->file, &filestat)) return -1;
+    if ((filestat.st_size <= 0) || (filestat.st_size > limit)) return -1;
+    child->outtotal = (int)filestat.st_size;
+
+    off_t offset = 0;
+    while (offset < filestat.st_size) {
+        ssize_t sent =
+            sendfile (fd, child->file, &offset, filestat.st_size - offset);
+        if (sent <= 0) return -1;
+    }
+    return (int)filestat.st_size;
+}
+
+int housecgi_execute_size (int id) {
+    if ((id < 0) || (id >= CgiChildrenCount)) return 0;
+    CgiChild *child = CgiChildren + id;
+    if ((child->running > 0) && (child->file >= 0)) {
+        struct stat filestat;
+        if (fstat (child->file, &filestat) == 0) {
+            if (filestat.st_size > HOUSECGI_OUTPUT_MAX)
+                return HOUSECGI_OUTPUT_MAX;
+            return (int)filestat.st_size;
+        }
+    }
+    return child->outtotal;
+}
+
+int housecgi_execute_pid (int id) {
+    if ((id < 0) || (id >= CgiChildrenCount)) return 0;
+    return (CgiChildren[id].running > 0) ? CgiChildren[id].running : 0;
+}
+
+int housecgi_execute_content (int id) {
+    if ((id < 0) || (id >= CgiChildrenCount)) return 0;
+    return CgiChildren[id].content;
+}
+
+int housecgi_execute_timedout (int id) {
+    if ((id < 0) || (id >= CgiChildrenCount)) return 0;
+    return CgiChildren[id].timedout;
+}
+
+int housecgi_execute_cancelled (int id) {
+    if ((id < 0) || (id >= CgiChildrenCount)) return 0;
+    return CgiChildren[id].cancelled != 0;
 }
 
 int housecgi_execute_max (int id) {
@@ -503,6 +1000,16 @@ int housecgi_execute_max (int id) {
     return CgiChildren[id].outmax;
 }
 
+const struct rusage *housecgi_execute_usage (int id) {
+    if ((id < 0) || (id >= CgiChildrenCount)) return 0;
+    return &(CgiChildren[id].usage);
+}
+
+int housecgi_execute_exit (int id) {
+    if ((id < 0) || (id >= CgiChildrenCount)) return 0;
+    return CgiChildren[id].exitstatus;
+}
+
 void housecgi_execute_background (time_t now) {
     int i;
     for (i = 0; i < CgiChildrenCount; ++i) {
@@ -20,17 +20,41 @@
  * housecgi_execute.h - Handle the running CGI applications.
  */
 
+#define HOUSECGI_OUTPUT_MAX 0x7ff00000 // Fits in an int, with some margin.
+
 void housecgi_execute_initialize (int argc, const char **argv);
 int housecgi_execute_declare (const char *name, const char *uri,
                               const char *path, const char *root);
 
+typedef void housecgi_execute_setter (const char *name, const char *value);
+
+void housecgi_execute_variables (const char *script, const char *root,
+                                 const char *method, const char *uri,
+                                 housecgi_execute_setter *set);
+int housecgi_execute_header (char *data, int length);
+
+int housecgi_execute_user (int id, const char *user);
+void housecgi_execute_priority (int id, int priority);
+
 void housecgi_execute_launch (int id,
                               const char *method, const char *uri,
                               const char *data, int length);
 int housecgi_execute_wait (int id, int blocking);
+void housecgi_execute_cancel (int id);
 const char *housecgi_execute_output (int id);
+char *housecgi_execute_copy (int id, int limit, int *length);
+int housecgi_execute_save (int id, int fd, int limit);
+int housecgi_execute_size (int id);
+int housecgi_execute_pid (int id);
+int housecgi_execute_content (int id);
+int housecgi_execute_timedout (int id);
+int housecgi_execute_cancelled (int id);
 int housecgi_execute_max (int id);
 
+struct rusage;
+const struct rusage *housecgi_execute_usage (int id);
+int housecgi_execute_exit (int id);
+
 void housecgi_execute_background (time_t now);
 int housecgi_execute_status (char *buffer, int size);
 
@@ -0,0 +1,868 @@
+/* HouseCGI - A simple home web service to support CGI applications.
+ *
+ * Copyright 2025, Pascal Martin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ * housecgi_git.c - Cache the git refs advertisements and clone packs.
+ *
+ * This module caches the responses of git-http-backend that only depend
+ * on the repository's references: the GET info/refs for git-upload-pack,
+ * and the protocol v2 ls-refs command. These are the requests issued by
+ * every fetch, including CI pollers. A cached response is used until the
+ * references of its repository change, which is detected using inotify
+ * on the repository's HEAD, packed-refs and refs directory tree.
+ *
+ * The cache is enabled for an application when its "gitroot" option is
+ * set to the git project root (GIT_PROJECT_ROOT) used by this application,
+ * for example:
+ *
+ *    -cgi-option=githttp:gitroot=/space/Projects
+ *
+ * The option -cgi-git-cache=N sets the maximum number of responses kept
+ * in the cache (default 64).
+ *
+ * If the CGI store is enabled (see housecgi_store.c), the pack responses
+ * to full clones are also kept, on disk. A full clone is an upload-pack
+ * request that wants only objects referenced by the current refs, and
+ * has none. These packs are identified by the repository, the state of
+ * its refs and the exact request, and are sent again using sendfile().
+ * This is mostly useful for CI systems that clone the same repositories
+ * again and again. The application should use the "memfd" option, so
+ * that large packs can be copied to disk.
+ *
+ * void housecgi_git_initialize (int argc, const char **argv);
+ *
+ *    Initialize this module.
+ *
+ * int housecgi_git_declare (const char *name, const char *uri);
+ *
+ *    Return the ID to use for this application, or -1 if the cache
+ *    does not apply to this application.
+ *
+ * const char *housecgi_git_lookup (int id,
+ *                                  const char *method, const char *uri,
+ *                                  const char *data, int length);
+ *
+ *    Search the cache for a response to this request. If found, the
+ *    response's header is applied and its content is returned. Otherwise
+ *    this returns 0. If the request is cacheable, the response will be
+ *    stored by the next call to housecgi_git_store().
+ *
+ * int housecgi_git_size (void);
+ *
+ *    Return the size of the content of the last response found
+ *    in the cache.
+ *
+ *    A pack found in the cache is not returned: it is transferred by
+ *    echttp directly from its file, and the content returned is empty.
+ *
+ * void housecgi_git_store (int id, int executor);
+ *
+ *    Store the response of the CGI executor if the last lookup was
+ *    for a cacheable request. This must be called before the CGI output
+ *    is retrieved.
+ *
+ * int housecgi_git_status (char *buffer, int size);
+ *
+ *    Return the cache statistics in JSON format.
+ *    Return -1 if the buffer is too small.
+ *
+ * NOTE
+ *
+ *    Each worker has its own cache.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <ctype.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "echttp.h"
+#include "echttp_hash.h"
+
+#include "housecgi_execute.h"
+#include "housecgi_git.h"
+#include "housecgi_option.h"
+#include "housecgi_store.h"
+
+#define GIT_RESPONSE_MAX (1024 * 1024) // Larger responses are not cached.
+#define GIT_WATCH_DEPTH  8
+#define GIT_HEADER_MAX   0x10000 // Same as the CGI header limit.
+
+typedef struct {
+    char *root;
+    char *uri;
+    int   urilength;
+} CgiGitApp;
+
+typedef struct {
+    char *repository;    // Full path.
+    long long signature; // Of the repository path.
+    int  watches[64];
+    int  count;
+} CgiGitRepository;
+
+typedef struct {
+    long long signature; // Of the key.
+    char *key;
+    int   repository;
+    char *response;      // The complete CGI output, header included.
+    int   length;
+    time_t used;
+} CgiGitEntry;
+
+static CgiGitApp *CgiGitApps = 0;
+static int CgiGitAppsCount = 0;
+
+static CgiGitRepository *CgiGitRepositories = 0;
+static int CgiGitRepositoriesCount = 0;
+
+static CgiGitEntry *CgiGitCache = 0;
+static int CgiGitCacheSize = 64;
+
+static int CgiGitNotify = -1;
+
+// The request being executed, if cacheable.
+static char CgiGitPendingKey[1024];
+static char CgiGitPendingName[64]; // For packs only.
+static int  CgiGitPendingPack = 0;
+static int  CgiGitPendingRepository = -1;
+
+// The response returned from the cache. The header is decoded in place,
+// so this is a copy of the cache entry.
+static char *CgiGitResponse = 0;
+static int   CgiGitResponseSize = 0;
+
+static long long CgiGitHits = 0;
+static long long CgiGitMisses = 0;
+static long long CgiGitInvalidations = 0;
+
+static long long CgiGitPackHits = 0;
+static long long CgiGitPackMisses = 0;
+static long long CgiGitPackStored = 0;
+
+// The state of a repository's refs: a hash of all refs, and the list
+// of all the objects they reference, as "\n<oid>\n<oid>\n..".
+//
+typedef struct {
+    unsigned long long hash;
+    char *oids;
+    int   length;
+    int   size;
+} CgiGitRefState;
+
+static void housecgi_git_invalidate (int repository) {
+
+    int i;
+    for (i = 0; i < CgiGitCacheSize; ++i) {
+        CgiGitEntry *entry = CgiGitCache + i;
+        if (!entry->key) continue;
+        if ((repository >= 0) && (entry->repository != repository)) continue;
+        free (entry->key);
+        free (entry->response);
+        entry->key = 0;
+        entry->response = 0;
+    }
+    // The watches are removed, because the directory tree may have
+    // changed: they are set again on the next cache miss.
+    for (i = 0; i < CgiGitRepositoriesCount; ++i) {
+        if ((repository >= 0) && (i != repository)) continue;
+        CgiGitRepository *repo = CgiGitRepositories + i;
+        int j;
+        for (j = 0; j < repo->count; ++j)
+            inotify_rm_watch (CgiGitNotify, repo->watches[j]);
+        repo->count = 0;
+    }
+    if (housecgi_store_enabled()) {
+        char prefix[64];
+        if (repository >= 0)
+            snprintf (prefix, sizeof(prefix), "git-%016llx-",
+                (unsigned long long)CgiGitRepositories[repository].signature);
+        else
+            snprintf (prefix, sizeof(prefix), "git-");
+        housecgi_store_remove (prefix);
+    }
+    CgiGitInvalidations += 1;
+}
+
+static int housecgi_git_watched (int wd) {
+    int i;
+    for (i = 0; i < CgiGitRepositoriesCount; ++i) {
+        int j;
+        for (j = 0; j < CgiGitRepositories[i].count; ++j) {
+            if (CgiGitRepositories[i].watches[j] == wd) return i;
+        }
+    }
+    return -1;
+}
+
+static void housecgi_git_notified (int fd, int mode) {
+
+    char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+    int length = read (fd, buffer, sizeof(buffer));
+    if (length <= 0) return;
+
+    char *cursor = buffer;
+    while (cursor < buffer + length) {
+        struct inotify_event *event = (struct inotify_event *)cursor;
+        cursor += sizeof(struct inotify_event) + event->len;
+
+        if (event->mask & IN_Q_OVERFLOW) {
+            housecgi_git_invalidate (-1); // Events were lost.
+            continue;
+        }
+        int repository = housecgi_git_watched (event->wd);
+        if (repository < 0) continue; // Already invalidated.
+
+        // The watch on the repository itself reports all its entries:
+        // only HEAD and the references matter.
+        CgiGitRepository *repo = CgiGitRepositories + repository;
+        if ((event->wd == repo->watches[0]) && (event->len > 0)) {
+            if (strcmp (event->name, "HEAD") &&
+                strcmp (event->name, "packed-refs") &&
+                strcmp (event->name, "refs") &&
+                strcmp (event->name, "reftable")) continue;
+        }
+        housecgi_git_invalidate (repository);
+    }
+}
+
+static void housecgi_git_watch (CgiGitRepository *repo,
+                                const char *path, int depth) {
+
+    static const int mask = IN_CREATE | IN_DELETE | IN_MOVED_TO |
+                            IN_MOVED_FROM | IN_CLOSE_WRITE |
+                            IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+
+    if (repo->count >= sizeof(repo->watches) / sizeof(int)) return;
+
+    int wd = inotify_add_watch (CgiGitNotify, path, mask);
+    if (wd < 0) return;
+    repo->watches[repo->count++] = wd;
+
+    if (depth <= 0) return;
+
+    DIR *dir = opendir (path);
+    if (!dir) return;
+    struct dirent *ent;
+    while ((ent = readdir (dir))) {
+        if (ent->d_name[0] == '.') continue;
+        if (ent->d_type != DT_DIR) continue;
+        char subpath[1024];
+        snprintf (subpath, sizeof(subpath), "%s/%s", path, ent->d_name);
+        housecgi_git_watch (repo, subpath, depth - 1);
+    }
+    closedir (dir);
+}
+
+static void housecgi_git_arm (int repository) {
+
+    CgiGitRepository *repo = CgiGitRepositories + repository;
+    if (repo->count > 0) return; // Already watched.
+
+    // The first watch must be the repository itself.
+    housecgi_git_watch (repo, repo->repository, 0);
+    if (repo->count <= 0) return;
+
+    char path[1024];
+    snprintf (path, sizeof(path), "%s/refs", repo->repository);
+    housecgi_git_watch (repo, path, GIT_WATCH_DEPTH);
+    snprintf (path, sizeof(path), "%s/reftable", repo->repository);
+    housecgi_git_watch (repo, path, 0);
+}
+
+void housecgi_git_initialize (int argc, const char **argv) {
+
+    int i;
+    const char *value;
+    for (i = 1; i < argc; ++i) {
+        if (echttp_option_match ("-cgi-git-cache=", argv[i], &value)) {
+            CgiGitCacheSize = atoi (value);
+            if (CgiGitCacheSize < 1) CgiGitCacheSize = 1;
+        }
+    }
+}
+
+int housecgi_git_declare (const char *name, const char *uri) {
+
+    const char *root = housecgi_option_get (name, "gitroot");
+    if (!root) return -1;
+
+    if (CgiGitNotify < 0) {
+        CgiGitNotify = inotify_init1 (IN_NONBLOCK|IN_CLOEXEC);
+        if (CgiGitNotify < 0) return -1;
+        echttp_listen (CgiGitNotify, 1, housecgi_git_notified, 0);
+        CgiGitCache = calloc (CgiGitCacheSize, sizeof(CgiGitEntry));
+    }
+
+    CgiGitApps = realloc (CgiGitApps, (CgiGitAppsCount+1) * sizeof(CgiGitApp));
+    CgiGitApps[CgiGitAppsCount].root = strdup (root);
+    CgiGitApps[CgiGitAppsCount].uri = strdup (uri);
+    CgiGitApps[CgiGitAppsCount].urilength = strlen (uri);
+    return CgiGitAppsCount++;
+}
+
+// Find the repository directory, the same way as git does: the name
+// can omit the ".git" suffix.
+//
+static int housecgi_git_repository (int id, const char *name, int length) {
+
+    static const char *suffixes[] = {".git/.git", "/.git", ".git", "", 0};
+
+    if (length <= 0) return -1;
+    char relative[512];
+    if (length >= sizeof(relative)) return -1;
+    memcpy (relative, name, length);
+    relative[length] = 0;
+    if (strstr (relative, "..")) return -1; // No escape.
+
+    char path[1024];
+    int i;
+    for (i = 0; suffixes[i]; ++i) {
+        struct stat filestat;
+        snprintf (path, sizeof(path), "%s%s%s/HEAD",
+                  CgiGitApps[id].root, relative, suffixes[i]);
+        if (stat (path, &filestat) == 0) break;
+    }
+    if (!suffixes[i]) return -1;
+    path[strlen(path)-5] = 0; // Remove "/HEAD".
+
+    long long signature = echttp_hash_signature (path);
+    for (i = 0; i < CgiGitRepositoriesCount; ++i) {
+        CgiGitRepository *repo = CgiGitRepositories + i;
+        if (repo->signature != signature) continue;
+        if (strcmp (repo->repository, path)) continue;
+        return i;
+    }
+    CgiGitRepositories = realloc (CgiGitRepositories,
+                           (CgiGitRepositoriesCount+1) * sizeof(CgiGitRepository));
+    CgiGitRepository *repo = CgiGitRepositories + CgiGitRepositoriesCount;
+    repo->repository = strdup (path);
+    repo->signature = signature;
+    repo->count = 0;
+    return CgiGitRepositoriesCount++;
+}
+
+static unsigned long long housecgi_git_digest (const char *data, int length) {
+    unsigned long long hash = 14695981039346656037ULL; // FNV-1a.
+    int i;
+    for (i = 0; i < length; ++i) {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static const char *housecgi_git_suffix (const char *path, const char *suffix) {
+    int length = strlen (path) - strlen (suffix);
+    if (length <= 0) return 0;
+    if (strcmp (path + length, suffix)) return 0;
+    return path + length;
+}
+
+static int housecgi_git_contains (const char *data, int length,
+                                  const char *text) {
+    int size = strlen (text);
+    const char *end = data + length - size;
+    for (; data <= end; ++data) {
+        if ((*data == *text) && (!memcmp (data, text, size))) return 1;
+    }
+    return 0;
+}
+
+static unsigned long long housecgi_git_mix (unsigned long long hash,
+                                            const char *data, int length) {
+    int i;
+    for (i = 0; i < length; ++i) {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void housecgi_git_refoid (CgiGitRefState *state, const char *text) {
+
+    int length = 0;
+    while (isxdigit(text[length])) length += 1;
+    if (length < 40) return; // Not an object ID.
+
+    if (state->length + length + 2 > state->size) {
+        state->size += 4096 + length;
+        state->oids = realloc (state->oids, state->size);
+    }
+    memcpy (state->oids + state->length, text, length);
+    state->length += length;
+    state->oids[state->length++] = '\n';
+    state->oids[state->length] = 0;
+}
+
+// Read a small file, e.g. HEAD or a loose ref.
+//
+static int housecgi_git_small (const char *path, char *buffer, int size) {
+    int fd = open (path, O_RDONLY|O_CLOEXEC);
+    if (fd < 0) return -1;
+    int length = read (fd, buffer, size - 1);
+    close (fd);
+    if (length < 0) return -1;
+    buffer[length] = 0;
+    return length;
+}
+
+static void housecgi_git_loose (CgiGitRefState *state,
+                                const char *path, int depth) {
+
+    DIR *dir = opendir (path);
+    if (!dir) return;
+    struct dirent *ent;
+    while ((ent = readdir (dir))) {
+        if (ent->d_name[0] == '.') continue;
+        char subpath[1024];
+        snprintf (subpath, sizeof(subpath), "%s/%s", path, ent->d_name);
+        if (ent->d_type == DT_DIR) {
+            if (depth > 0) housecgi_git_loose (state, subpath, depth - 1);
+            continue;
+        }
+        char content[256];
+        int length = housecgi_git_small (subpath, content, sizeof(content));
+        if (length < 0) continue;
+        // The order of the directory entries is not significant.
+        state->hash += housecgi_git_mix
+                           (housecgi_git_digest (subpath, strlen(subpath)),
+                            content, length);
+        if (strncmp (content, "ref:", 4)) housecgi_git_refoid (state, content);
+    }
+    closedir (dir);
+}
+
+static int housecgi_git_packed (CgiGitRefState *state, const char *path) {
+
+    int fd = open (path, O_RDONLY|O_CLOEXEC);
+    if (fd < 0) return 0; // No packed refs.
+    struct stat filestat;
+    if (fstat (fd, &filestat)) {
+        close (fd);
+        return -1;
+    }
+    char *content = malloc (filestat.st_size + 1);
+    int length = read (fd, content, filestat.st_size);
+    close (fd);
+    if (length != filestat.st_size) {
+        free (content);
+        return -1;
+    }
+    content[length] = 0;
+    state->hash = housecgi_git_mix (state->hash, content, length);
+
+    char *line = content;
+    while (*line) {
+        if (*line == '^') housecgi_git_refoid (state, line + 1);
+        else if (*line != '#') housecgi_git_refoid (state, line);
+        char *eol = strchr (line, '\n');
+        if (!eol) break;
+        line = eol + 1;
+    }
+    free (content);
+    return 0;
+}
+
+// Compute the current state of the repository's refs. Return 0 on success,
+// -1 if the refs cannot be read (e.g. reftable format).
+//
+static int housecgi_git_refstate (const char *repository,
+                                  CgiGitRefState *state) {
+
+    char path[1024];
+    struct stat filestat;
+
+    state->hash = 14695981039346656037ULL;
+    state->size = 4096;
+    state->oids = malloc (state->size);
+    state->oids[0] = '\n';
+    state->oids[1] = 0;
+    state->length = 1;
+
+    snprintf (path, sizeof(path), "%s/reftable", repository);
+    if (stat (path, &filestat) == 0) return -1;
+
+    char head[256];
+    snprintf (path, sizeof(path), "%s/HEAD", repository);
+    int length = housecgi_git_small (path, head, sizeof(head));
+    if (length <= 0) return -1;
+    state->hash = housecgi_git_mix (state->hash, head, length);
+    if (strncmp (head, "ref:", 4)) housecgi_git_refoid (state, head);
+
+    snprintf (path, sizeof(path), "%s/packed-refs", repository);
+    if (housecgi_git_packed (state, path)) return -1;
+
+    snprintf (path, sizeof(path), "%s/refs", repository);
+    housecgi_git_loose (state, path, GIT_WATCH_DEPTH);
+    return 0;
+}
+
+static int housecgi_git_pktlength (const char *data) {
+    int length = 0;
+    int i;
+    for (i = 0; i < 4; ++i) {
+        int c = data[i];
+        if ((c >= '0') && (c <= '9')) c -= '0';
+        else if ((c >= 'a') && (c <= 'f')) c -= 'a' - 10;
+        else if ((c >= 'A') && (c <= 'F')) c -= 'A' - 10;
+        else return -1;
+        length = (length << 4) + c;
+    }
+    return length;
+}
+
+static int housecgi_git_prefix (const char *line, int length,
+                                const char *prefix) {
+    int size = strlen (prefix);
+    if (length < size) return 0;
+    return (!strncmp (line, prefix, size));
+}
+
+// Return 1 if this upload-pack request is a full clone: it wants only
+// objects referenced by the current refs, and has none. This decodes
+// the pkt-line format, for protocol v0 and v2.
+//
+static int housecgi_git_clone (const CgiGitRefState *state,
+                               const char *data, int length) {
+
+    int wants = 0;
+    int done = 0;
+    const char *end = data + length;
+
+    while (data + 4 <= end) {
+        int size = housecgi_git_pktlength (data);
+        if (size < 0) return 0;
+        if (size < 4) { // Flush, delimiter or response end.
+            data += 4;
+            continue;
+        }
+        if (data + size > end) return 0;
+        const char *line = data + 4;
+        int linelength = size - 4;
+        data += size;
+        if ((linelength > 0) && (line[linelength-1] == '\n')) linelength -= 1;
+
+        if (housecgi_git_prefix (line, linelength, "want ")) {
+            char needle[80];
+            int oid = 0;
+            needle[0] = '\n';
+            while ((oid < linelength - 5) && (oid < 64) &&
+                   isxdigit(line[5+oid])) {
+                needle[oid+1] = line[5+oid];
+                oid += 1;
+            }
+            if (oid < 40) return 0;
+            needle[oid+1] = '\n';
+            needle[oid+2] = 0;
+            if (!strstr (state->oids, needle)) return 0; // Not a ref.
+            wants += 1;
+        } else if (housecgi_git_prefix (line, linelength, "have ") ||
+                   housecgi_git_prefix (line, linelength, "shallow ")) {
+            return 0; // The client already has some objects.
+        } else if (housecgi_git_prefix (line, linelength, "command=")) {
+            if (!housecgi_git_prefix (line, linelength, "command=fetch"))
+                return 0;
+        } else if ((linelength == 4) && (!strncmp (line, "done", 4))) {
+            done = 1;
+        }
+    }
+    return (wants > 0) && done;
+}
+
+// Send a pack from the store. The file starts with the cache key,
+// followed by the complete CGI output.
+//
+static const char *housecgi_git_replay (const char *name, const char *key) {
+
+    int fd = housecgi_store_open (name);
+    if (fd < 0) return 0;
+
+    struct stat filestat;
+    if (fstat (fd, &filestat)) {
+        close (fd);
+        return 0;
+    }
+    CgiGitResponse = realloc (CgiGitResponse, GIT_HEADER_MAX + 1);
+    int length = pread (fd, CgiGitResponse, GIT_HEADER_MAX, 0);
+    int keylength = strlen (key);
+    if ((length <= keylength) ||
+        memcmp (CgiGitResponse, key, keylength) ||
+        (CgiGitResponse[keylength] != '\n')) {
+        close (fd); // Not the same request, after all.
+        return 0;
+    }
+    CgiGitResponse[length] = 0;
+    int start = keylength + 1;
+    int body = housecgi_execute_header (CgiGitResponse + start,
+                                        length - start);
+    if (body < 0) {
+        close (fd); // Not a valid response: run the CGI.
+        return 0;
+    }
+    body += start;
+    CgiGitResponseSize = filestat.st_size - body;
+    if (CgiGitResponseSize <= 0) {
+        close (fd);
+        CgiGitResponseSize = 0;
+        return "";
+    }
+    lseek (fd, body, SEEK_SET);
+    echttp_transfer (fd, CgiGitResponseSize);
+    return "";
+}
+
+static const char *housecgi_git_pack (int repository, const char *protocol,
+                                      const char *data, int length) {
+
+    if (!housecgi_store_enabled()) return 0;
+    if (echttp_attribute_get ("Content-Encoding")) return 0; // Compressed.
+
+    CgiGitRepository *repo = CgiGitRepositories + repository;
+    CgiGitRefState state;
+    int clone = 0;
+    if (housecgi_git_refstate (repo->repository, &state) == 0)
+        clone = housecgi_git_clone (&state, data, length);
+    free (state.oids);
+    if (!clone) return 0;
+
+    snprintf (CgiGitPendingKey, sizeof(CgiGitPendingKey),
+              "%s POST %s %016llx %016llx", repo->repository, protocol,
+              state.hash, housecgi_git_digest (data, length));
+    snprintf (CgiGitPendingName, sizeof(CgiGitPendingName),
+              "git-%016llx-%016llx", (unsigned long long)repo->signature,
+              (unsigned long long)echttp_hash_signature (CgiGitPendingKey));
+
+    const char *output = housecgi_git_replay (CgiGitPendingName,
+                                              CgiGitPendingKey);
+    if (output) {
+        CgiGitPackHits += 1;
+        return output;
+    }
+    CgiGitPackMisses += 1;
+
+    // The key depends on the refs, but the watches remove the obsolete
+    // packs early, instead of waiting for the quota to do it.
+    housecgi_git_arm (repository);
+    CgiGitPendingRepository = repository;
+    CgiGitPendingPack = 1;
+    return 0;
+}
+
+const char *housecgi_git_lookup (int id,
+                                 const char *method, const char *uri,
+                                 const char *data, int length) {
+
+    CgiGitPendingRepository = -1;
+    CgiGitPendingPack = 0;
+    if ((id < 0) || (id >= CgiGitAppsCount)) return 0;
+
+    // The repository is the beginning of the PATH_INFO.
+    if (strncmp (uri, CgiGitApps[id].uri, CgiGitApps[id].urilength)) return 0;
+    const char *path = uri + CgiGitApps[id].urilength;
+
+    const char *protocol = echttp_attribute_get ("Git-Protocol");
+    if (!protocol) protocol = "";
+
+    const char *end = 0;
+    unsigned long long digest = 0;
+    if (!strcmp (method, "GET")) {
+        end = housecgi_git_suffix (path, "/info/refs");
+        const char *service = echttp_parameter_get ("service");
+        if ((!service) || strcmp (service, "git-upload-pack")) return 0;
+    } else if (!strcmp (method, "POST")) {
+        end = housecgi_git_suffix (path, "/git-upload-pack");
+        if ((!end) || (!data) || (length <= 0)) return 0;
+        if ((!strstr (protocol, "version=2")) ||
+            (!housecgi_git_contains (data, length, "command=ls-refs"))) {
+            // Not a refs request: this might be a full clone.
+            int repository = housecgi_git_repository (id, path, end - path);
+            if (repository < 0) return 0;
+            return housecgi_git_pack (repository, protocol, data, length);
+        }
+        digest = housecgi_git_digest (data, length);
+    }
+    if (!end) return 0;
+
+    int repository = housecgi_git_repository (id, path, end - path);
+    if (repository < 0) return 0;
+
+    char *key = CgiGitPendingKey;
+    snprintf (key, sizeof(CgiGitPendingKey), "%s %s %s %016llx",
+              CgiGitRepositories[repository].repository,
+              method, protocol, digest);
+    long long signature = echttp_hash_signature (key);
+
+    int i;
+    for (i = 0; i < CgiGitCacheSize; ++i) {
+        CgiGitEntry *entry = CgiGitCache + i;
+        if (!entry->key) continue;
+        if (entry->signature != signature) continue;
+        if (strcmp (entry->key, key)) continue;
+
+        // Found. Apply the response header, the same way as for
+        // a CGI output, but on a copy.
+        entry->used = time(0);
+        CgiGitHits += 1;
+        CgiGitResponse = realloc (CgiGitResponse, entry->length + 1);
+        memcpy (CgiGitResponse, entry->response, entry->length);
+        CgiGitResponse[entry->length] = 0;
+        int body = housecgi_execute_header (CgiGitResponse, entry->length);
+        if (body < 0) return 0; // Not a valid response: run the CGI.
+        CgiGitResponseSize = entry->length - body;
+        if (CgiGitResponseSize <= 0) {
+            CgiGitResponseSize = 0;
+            return "";
+        }
+        echttp_content_length (CgiGitResponseSize);
+        return CgiGitResponse + body;
+    }
+    CgiGitMisses += 1;
+
+    // Watch the repository before the CGI runs, so that any change made
+    // while the response is being built invalidates it.
+    housecgi_git_arm (repository);
+    if (CgiGitRepositories[repository].count > 0)
+        CgiGitPendingRepository = repository;
+    return 0;
+}
+
+int housecgi_git_size (void) {
+    return CgiGitResponseSize;
+}
+
+// Only cache successful responses.
+//
+static int housecgi_git_success (const char *response, int length) {
+
+    const char *line = response;
+    const char *end = response + length;
+    while (line < end) {
+        const char *eol = memchr (line, '\n', end - line);
+        if (!eol) return 0; // No end of header.
+        if ((eol == line) || ((eol == line + 1) && (*line == '\r'))) return 1;
+        if ((eol - line > 7) && (!strncasecmp (line, "Status:", 7))) {
+            const char *value = line + 7;
+            while (*value == ' ') ++value;
+            if (atoi (value) != 200) return 0;
+        }
+        line = eol + 1;
+    }
+    return 0;
+}
+
+static void housecgi_git_keep (int executor) {
+
+    int fd = housecgi_store_create ();
+    if (fd < 0) return;
+
+    int keylength = strlen (CgiGitPendingKey);
+    CgiGitPendingKey[keylength] = '\n';
+    int written = write (fd, CgiGitPendingKey, keylength + 1);
+    CgiGitPendingKey[keylength] = 0;
+    if (written != keylength + 1) {
+        close (fd);
+        return;
+    }
+    if (housecgi_execute_save (executor, fd,
+                               housecgi_store_limit() - written) <= 0) {
+        close (fd);
+        return;
+    }
+    char header[4096];
+    int length = pread (fd, header, sizeof(header), written);
+    if ((length <= 0) || (!housecgi_git_success (header, length))) {
+        close (fd);
+        return;
+    }
+    if (housecgi_store_publish (fd, CgiGitPendingName))
+        CgiGitPackStored += 1;
+}
+
+void housecgi_git_store (int id, int executor) {
+
+    int repository = CgiGitPendingRepository;
+    int pack = CgiGitPendingPack;
+    CgiGitPendingRepository = -1;
+    CgiGitPendingPack = 0;
+    if ((id < 0) || (repository < 0)) return;
+    if (housecgi_execute_timedout (executor)) return;
+    if (housecgi_execute_cancelled (executor)) return;
+
+    if (pack) {
+        housecgi_git_keep (executor);
+        return;
+    }
+
+    int length;
+    char *response = housecgi_execute_copy (executor, GIT_RESPONSE_MAX, &length);
+    if (!response) return;
+    if (!housecgi_git_success (response, length)) {
+        free (response);
+        return;
+    }
+
+    // Use a free slot, or else replace the least recently used entry.
+    int i;
+    int slot = 0;
+    for (i = 0; i < CgiGitCacheSize; ++i) {
+        if (!CgiGitCache[i].key) {
+            slot = i;
+            break;
+        }
+        if (CgiGitCache[i].used < CgiGitCache[slot].used) slot = i;
+    }
+    CgiGitEntry *entry = CgiGitCache + slot;
+    if (entry->key) free (entry->key);
+    if (entry->response) free (entry->response);
+
+    entry->key = strdup (CgiGitPendingKey);
+    entry->signature = echttp_hash_signature (entry->key);
+    entry->repository = repository;
+    entry->response = response;
+    entry->length = length;
+    entry->used = time(0);
+}
+
+int housecgi_git_status (char *buffer, int size) {
+
+    int entries = 0;
+    int i;
+    for (i = 0; i < CgiGitCacheSize; ++i) {
+        if (CgiGitCache && CgiGitCache[i].key) entries += 1;
+    }
+    int cursor = snprintf (buffer, size,
+                           "\"gitcache\":{\"size\":%d,\"entries\":%d"
+                               ",\"hits\":%lld,\"misses\":%lld"
+                               ",\"invalidations\":%lld"
+                               ",\"packs\":{\"hits\":%lld,\"misses\":%lld"
+                               ",\"stored\":%lld}}",
+                           CgiGitCacheSize, entries,
+                           CgiGitHits, CgiGitMisses, CgiGitInvalidations,
+                           CgiGitPackHits, CgiGitPackMisses, CgiGitPackStored);
+    if (cursor >= size) return -1;
+    return cursor;
+}
@@ -0,0 +1,32 @@
+/* HouseCGI - A simple home web service to support CGI applications.
+ *
+ * Copyright 2025, Pascal Martin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ * housecgi_git.h - Cache the git refs advertisements.
+ */
+
+void housecgi_git_initialize (int argc, const char **argv);
+int  housecgi_git_declare (const char *name, const char *uri);
+
+const char *housecgi_git_lookup (int id,
+                                 const char *method, const char *uri,
+                                 const char *data, int length);
+int  housecgi_git_size (void);
+void housecgi_git_store (int id, int executor);
+
+int  housecgi_git_status (char *buffer, int size);
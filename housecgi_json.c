@@ -0,0 +1,178 @@
+/* HouseCGI - A simple home web service to support CGI applications.
+ *
+ * Copyright 2025, Pascal Martin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ * housecgi_json.c - Build a JSON response of any size.
+ *
+ * This module accumulates a JSON text in a buffer that grows as needed.
+ * The buffer is kept from one response to the next, so that no memory
+ * allocation happens once it has reached the size of a typical response.
+ * Only one response can be built at a time.
+ *
+ * void housecgi_json_start (void);
+ *
+ *    Start a new JSON text.
+ *
+ * void housecgi_json_add (const char *format, ...);
+ *
+ *    Append formatted text (printf style).
+ *
+ * char *housecgi_json_reserve (int size);
+ * void  housecgi_json_commit (int length);
+ *
+ *    Get space for appending up to size characters, and then append the
+ *    characters that were actually written there. This is meant for the
+ *    status functions that write to a buffer of limited size.
+ *
+ * void housecgi_json_status (const char *separator,
+ *                           int (*status) (char *buffer, int size));
+ *
+ *    Append the output of a status function, preceded by the separator.
+ *    The status function returns the length of its text, 0 if it has
+ *    nothing to report, or -1 if the buffer is too small. Nothing is
+ *    appended for an empty text, not even the separator. If the text
+ *    did not fit, the function is called again with a larger buffer.
+ *
+ * const char *housecgi_json_escape (char *buffer, int size,
+ *                                   const char *text);
+ *
+ *    Escape a text, for example a name, so that it can be used as
+ *    a JSON string value. The escaped text is written to the buffer,
+ *    truncated if necessary, and the buffer is returned.
+ *
+ * const char *housecgi_json_end (void);
+ *
+ *    Return the complete JSON text. It remains valid until the next
+ *    call to housecgi_json_start().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "housecgi_json.h"
+
+#define JSON_STATUS_MIN 0x10000
+#define JSON_STATUS_MAX 0x1000000
+
+static char *CgiJson = 0;
+static int   CgiJsonSize = 0;
+static int   CgiJsonLength = 0;
+
+static int housecgi_json_grow (int needed) {
+
+    if (CgiJsonLength + needed < CgiJsonSize) return 1;
+
+    int size = CgiJsonSize ? CgiJsonSize : 0x10000;
+    while (CgiJsonLength + needed >= size) size *= 2;
+    char *grown = realloc (CgiJson, size);
+    if (!grown) return 0;
+    CgiJson = grown;
+    CgiJsonSize = size;
+    return 1;
+}
+
+void housecgi_json_start (void) {
+    CgiJsonLength = 0;
+    if (housecgi_json_grow (1)) CgiJson[0] = 0;
+}
+
+void housecgi_json_add (const char *format, ...) {
+
+    if (!CgiJson) return;
+
+    va_list args;
+    va_start (args, format);
+    int length = vsnprintf (CgiJson + CgiJsonLength,
+                            CgiJsonSize - CgiJsonLength, format, args);
+    va_end (args);
+    if (length < 0) return;
+    if (CgiJsonLength + length >= CgiJsonSize) {
+        if (!housecgi_json_grow (length + 1)) {
+            CgiJson[CgiJsonLength] = 0; // Drop this text.
+            return;
+        }
+        va_start (args, format);
+        vsnprintf (CgiJson + CgiJsonLength,
+                   CgiJsonSize - CgiJsonLength, format, args);
+        va_end (args);
+    }
+    CgiJsonLength += length;
+}
+
+char *housecgi_json_reserve (int size) {
+    if (!housecgi_json_grow (size + 1)) return 0;
+    return CgiJson + CgiJsonLength;
+}
+
+void housecgi_json_commit (int length) {
+    if ((length <= 0) || (CgiJsonLength + length >= CgiJsonSize)) {
+        if (CgiJson) CgiJson[CgiJsonLength] = 0; // Discard.
+        return;
+    }
+    CgiJsonLength += length;
+    CgiJson[CgiJsonLength] = 0;
+}
+
+void housecgi_json_status (const char *separator,
+                           int (*status) (char *buffer, int size)) {
+
+    int length = strlen (separator);
+    int size;
+    for (size = JSON_STATUS_MIN; size <= JSON_STATUS_MAX; size *= 2) {
+        char *buffer = housecgi_json_reserve (length + size);
+        if (!buffer) return;
+        memcpy (buffer, separator, length);
+        buffer[length] = 0;
+        int cursor = status (buffer + length, size);
+        if (cursor > 0) {
+            housecgi_json_commit (length + cursor);
+            return;
+        }
+        if (cursor == 0) break; // Nothing to report.
+    }
+    housecgi_json_commit (0); // Discard.
+}
+
+const char *housecgi_json_escape (char *buffer, int size, const char *text) {
+
+    int cursor = 0;
+    for (; *text; ++text) {
+        unsigned char c = (unsigned char)(*text);
+        char escaped[8];
+        if ((c == '"') || (c == '\\')) {
+            snprintf (escaped, sizeof(escaped), "\\%c", c);
+        } else if (c < ' ') {
+            snprintf (escaped, sizeof(escaped), "\\u%04x", c);
+        } else {
+            escaped[0] = c;
+            escaped[1] = 0;
+        }
+        int length = strlen (escaped);
+        if (cursor + length >= size) break; // Never split an escape.
+        memcpy (buffer + cursor, escaped, length);
+        cursor += length;
+    }
+    if (size > 0) buffer[cursor] = 0;
+    return buffer;
+}
+
+const char *housecgi_json_end (void) {
+    return CgiJson ? CgiJson : "";
+}
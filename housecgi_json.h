@@ -0,0 +1,34 @@
+/* HouseCGI - A simple home web service to support CGI applications.
+ *
+ * Copyright 2025, Pascal Martin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ * housecgi_json.h - Build a JSON response of any size.
+ */
+
+void housecgi_json_start (void);
+void housecgi_json_add (const char *format, ...);
+
+char *housecgi_json_reserve (int size);
+void  housecgi_json_commit (int length);
+
+void housecgi_json_status (const char *separator,
+                           int (*status) (char *buffer, int size));
+
+const char *housecgi_json_escape (char *buffer, int size, const char *text);
+
+const char *housecgi_json_end (void);
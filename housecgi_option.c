@@ -0,0 +1,130 @@
+/* HouseCGI - A simple home web service to support CGI applications.
+ *
+ * Copyright 2025, Pascal Martin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ * housecgi_option.c - Per application options.
+ *
+ * This module decodes the options that apply to specific CGI applications.
+ * These options are provided on the command line, using the syntax:
+ *
+ *    -cgi-option=<app>:<key>[=<value>][,<key>[=<value>]..]
+ *
+ * The application name "*" defines a default for all applications.
+ *
+ * Some applications have built-in defaults, which can be overridden on
+ * the command line: git-http-backend ("githttp") is a bulk application,
+ * which runs with a lower CPU and I/O priority.
+ *
+ * void housecgi_option_initialize (int argc, const char **argv);
+ *
+ *    Initialize this module.
+ *
+ * const char *housecgi_option_get (const char *app, const char *key);
+ *
+ *    Return the value of the specified option for this application, or
+ *    the default value if this application has no such option. Return an
+ *    empty string if the option has no value, a null pointer if the option
+ *    is not set at all.
+ *
+ * int housecgi_option_integer (const char *app, const char *key, int fallback);
+ *
+ *    Return the numeric value of the specified option for this application,
+ *    or fallback if the option is not set.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "echttp.h"
+
+#include "housecgi_option.h"
+
+typedef struct {
+    const char *app;
+    const char *key;
+    const char *value;
+} CgiOption;
+
+static CgiOption *CgiOptions = 0;
+static int CgiOptionsCount = 0;
+static int CgiOptionsSize = 0;
+
+static void housecgi_option_add (const char *app,
+                                 const char *key, const char *value) {
+
+    if (CgiOptionsCount >= CgiOptionsSize) {
+        CgiOptionsSize += 16;
+        CgiOptions = realloc (CgiOptions, CgiOptionsSize * sizeof(CgiOption));
+    }
+    CgiOptions[CgiOptionsCount].app = app;
+    CgiOptions[CgiOptionsCount].key = key;
+    CgiOptions[CgiOptionsCount].value = value;
+    CgiOptionsCount += 1;
+}
+
+static void housecgi_option_decode (const char *text) {
+
+    char *option = strdup (text); // Never freed: referenced by the table.
+    char *keys = strchr (option, ':');
+    if (!keys) return;
+    *(keys++) = 0;
+
+    char *key;
+    for (key = strtok (keys, ","); key; key = strtok (0, ",")) {
+        char *value = strchr (key, '=');
+        if (value) *(value++) = 0;
+        else value = "";
+        housecgi_option_add (option, key, value);
+    }
+}
+
+void housecgi_option_initialize (int argc, const char **argv) {
+
+    housecgi_option_decode ("githttp:class=bulk,nice=10,policy=batch,ionice=7");
+
+    int i;
+    const char *value;
+    for (i = 1; i < argc; ++i) {
+        if (echttp_option_match ("-cgi-option=", argv[i], &value)) {
+            housecgi_option_decode (value);
+        }
+    }
+}
+
+const char *housecgi_option_get (const char *app, const char *key) {
+
+    const char *fallback = 0;
+
+    // The last occurrence wins, so that the command line can override
+    // defaults from a configuration file.
+    int i;
+    for (i = CgiOptionsCount - 1; i >= 0; --i) {
+        if (strcmp (CgiOptions[i].key, key)) continue;
+        if (!strcmp (CgiOptions[i].app, app)) return CgiOptions[i].value;
+        if ((!fallback) && (!strcmp (CgiOptions[i].app, "*")))
+            fallback = CgiOptions[i].value;
+    }
+    return fallback;
+}
+
+int housecgi_option_integer (const char *app, const char *key, int fallback) {
+    const char *value = housecgi_option_get (app, key);
+    if ((!value) || (!*value)) return fallback;
+    return atoi (value);
+}
@@ -0,0 +1,197 @@
+/* HouseCGI - A simple home web service to support CGI applications.
+ *
+ * Copyright 2025, Pascal Martin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ * housecgi_priority.c - Set the CPU and I/O priority of CGI children.
+ *
+ * This module decodes the per application options that control how the
+ * OS schedules the CGI children, and applies them to each child when it
+ * is launched:
+ *
+ *    nice=N                       The nice level (-20 to 19).
+ *    policy=other|batch|idle      The CPU scheduling policy.
+ *    ionice=idle|N                The I/O priority: the idle class, or
+ *                                 the best-effort class at level N (0-7).
+ *    affinity=MASK                The CPUs allowed, as an hexadecimal mask.
+ *
+ * For example:
+ *
+ *    -cgi-option=githttp:nice=10,policy=batch,ionice=7,affinity=0xc
+ *
+ * This is on a best effort basis: a setting that is not permitted, e.g.
+ * a negative nice level when not running as root, is ignored.
+ *
+ * int  housecgi_priority_declare (int app, const char *name);
+ *
+ *    Load the priority options for the specified application. Return
+ *    the app index if the application has any priority option, or -1.
+ *
+ * void housecgi_priority_apply (int app);
+ *
+ *    Apply the priority options of the specified application to the
+ *    current process. This is meant to be called in the CGI child.
+ *
+ * int  housecgi_priority_app_status (int app, char *buffer, int size);
+ *
+ *    Return the priority options for one application, as JSON fields
+ *    meant to be inserted in the application's object. The text starts
+ *    with a comma.
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "housecgi_priority.h"
+#include "housecgi_option.h"
+#include "housecgi_stat.h"
+
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_BE    2
+#define IOPRIO_CLASS_IDLE  3
+#define IOPRIO_WHO_PROCESS 1
+
+typedef struct {
+    int set;
+    int nice;
+    int nicing;   // nice was set.
+    int policy;   // -1 if not set.
+    int ioprio;   // 0 if not set.
+    unsigned long long affinity; // 0 if not set.
+} CgiPriority;
+
+static CgiPriority CgiPriorities[HOUSECGI_APPS_MAX];
+
+static const char *housecgi_priority_policy_name (int policy) {
+    switch (policy) {
+        case SCHED_OTHER: return "other";
+        case SCHED_BATCH: return "batch";
+        case SCHED_IDLE:  return "idle";
+    }
+    return "default";
+}
+
+int housecgi_priority_declare (int app, const char *name) {
+
+    if ((app < 0) || (app >= HOUSECGI_APPS_MAX)) return -1;
+
+    CgiPriority *priority = CgiPriorities + app;
+    memset (priority, 0, sizeof(CgiPriority));
+    priority->policy = -1;
+
+    const char *value = housecgi_option_get (name, "nice");
+    if (value && *value) {
+        priority->nice = atoi (value);
+        if (priority->nice < -20) priority->nice = -20;
+        if (priority->nice > 19) priority->nice = 19;
+        priority->nicing = 1;
+    }
+
+    value = housecgi_option_get (name, "policy");
+    if (value) {
+        if (!strcmp (value, "other")) priority->policy = SCHED_OTHER;
+        else if (!strcmp (value, "batch")) priority->policy = SCHED_BATCH;
+        else if (!strcmp (value, "idle")) priority->policy = SCHED_IDLE;
+    }
+
+    value = housecgi_option_get (name, "ionice");
+    if (value && *value) {
+        if (!strcmp (value, "idle")) {
+            priority->ioprio = IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT;
+        } else {
+            int level = atoi (value);
+            if (level < 0) level = 0;
+            if (level > 7) level = 7;
+            priority->ioprio = (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | level;
+        }
+    }
+
+    value = housecgi_option_get (name, "affinity");
+    if (value && *value) priority->affinity = strtoull (value, 0, 16);
+
+    priority->set = priority->nicing || (priority->policy >= 0) ||
+                    priority->ioprio || priority->affinity;
+    return priority->set ? app : -1;
+}
+
+void housecgi_priority_apply (int app) {
+
+    if ((app < 0) || (app >= HOUSECGI_APPS_MAX)) return;
+
+    const CgiPriority *priority = CgiPriorities + app;
+    if (!priority->set) return;
+
+    if (priority->policy >= 0) {
+        struct sched_param param = {0};
+        sched_setscheduler (0, priority->policy, &param);
+    }
+    if (priority->nicing) setpriority (PRIO_PROCESS, 0, priority->nice);
+
+    if (priority->ioprio)
+        syscall (SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, priority->ioprio);
+
+    if (priority->affinity) {
+        cpu_set_t cpus;
+        CPU_ZERO (&cpus);
+        int i;
+        for (i = 0; i < 64; ++i) {
+            if (priority->affinity & (1ULL << i)) CPU_SET (i, &cpus);
+        }
+        sched_setaffinity (0, sizeof(cpus), &cpus);
+    }
+}
+
+int housecgi_priority_app_status (int app, char *buffer, int size) {
+
+    if ((app < 0) || (app >= HOUSECGI_APPS_MAX)) return 0;
+
+    const CgiPriority *priority = CgiPriorities + app;
+    if (!priority->set) return 0;
+
+    int cursor = snprintf (buffer, size, ",\"priority\":{\"policy\":\"%s\"",
+                           housecgi_priority_policy_name (priority->policy));
+    if (cursor >= size) return 0;
+    if (priority->nicing) {
+        cursor += snprintf (buffer+cursor, size-cursor,
+                            ",\"nice\":%d", priority->nice);
+        if (cursor >= size) return 0;
+    }
+    if (priority->ioprio) {
+        int class = priority->ioprio >> IOPRIO_CLASS_SHIFT;
+        if (class == IOPRIO_CLASS_IDLE)
+            cursor += snprintf (buffer+cursor, size-cursor, ",\"io\":\"idle\"");
+        else
+            cursor += snprintf (buffer+cursor, size-cursor,
+                                ",\"io\":\"best-effort:%d\"",
+                                priority->ioprio & 7);
+        if (cursor >= size) return 0;
+    }
+    if (priority->affinity) {
+        cursor += snprintf (buffer+cursor, size-cursor,
+                            ",\"affinity\":\"0x%llx\"", priority->affinity);
+        if (cursor >= size) return 0;
+    }
+    cursor += snprintf (buffer+cursor, size-cursor, "}");
+    if (cursor >= size) return 0;
+    return cursor;
+}
@@ -0,0 +1,566 @@
+/* HouseCGI - A simple home web service to support CGI applications.
+ *
+ * Copyright 2025, Pascal Martin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ * housecgi_proxy.c - Forward requests to local SCGI or HTTP servers.
+ *
+ * This module handles the applications that run as long-lived local
+ * servers, listening on a Unix socket, instead of CGI executables. The
+ * requests are forwarded to the server using either the SCGI protocol
+ * or HTTP/1.1, which avoids forking a process for every request.
+ *
+ * int housecgi_proxy_declare (const char *name, const char *uri,
+ *                             const char *socket, int protocol);
+ *
+ *    Register a new upstream server. This returns an ID that can be used
+ *    when forwarding requests to that server.
+ *
+ * const char *housecgi_proxy_forward (int id,
+ *                                     const char *method, const char *uri,
+ *                                     const char *data, int length);
+ *
+ *    Forward the current echttp request to the specified server, wait
+ *    for the complete response and return its content. The response
+ *    header is decoded and set as HTTP attributes for this request.
+ *
+ * int housecgi_proxy_size (int id);
+ *
+ *    Return the size of the last response received from this server.
+ *
+ * NOTE
+ *
+ *    Idle HTTP connections are kept open and reused for the next request.
+ *    SCGI connections cannot be reused: the SCGI protocol requires the
+ *    server to close the connection at the end of each response.
+ *
+ *    The requests are forwarded synchronously, consistent with how CGI
+ *    applications are executed.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "echttp.h"
+#include "echttp_hash.h"
+#include "echttp_libc.h"
+
+#include "housecgi_execute.h"
+#include "housecgi_capture.h"
+#include "housecgi_proxy.h"
+#include "housecgi_trace.h"
+
+#define PROXY_POOL    4
+#define PROXY_TIMEOUT 5000 // Milliseconds, same as the CGI timeout.
+
+typedef struct {
+    char *name;
+    long long signature;
+    char *uri;
+    char *socket;
+    int   protocol;
+    int   idle[PROXY_POOL];
+    int   idlecount;
+    char *response;
+    int   size;
+    int   length;
+    int   total;
+} CgiUpstream;
+
+static CgiUpstream *CgiUpstreams = 0;
+static int CgiUpstreamsCount = 0;
+static int CgiUpstreamsSize = 0;
+
+// The request being built. This is used by the SCGI variable setter.
+static char *CgiProxyRequest = 0;
+static int   CgiProxyRequestSize = 0;
+static int   CgiProxyRequestLength = 0;
+
+static int housecgi_proxy_search (const char *name) {
+
+    long long signature = echttp_hash_signature (name);
+    int i;
+    for (i = 0; i < CgiUpstreamsCount; ++i) {
+        if (CgiUpstreams[i].signature != signature) continue;
+        if (strcmp (CgiUpstreams[i].name, name)) continue;
+        return i;
+    }
+    return -1;
+}
+
+static void housecgi_proxy_flush (CgiUpstream *upstream) {
+    int i;
+    for (i = 0; i < upstream->idlecount; ++i) close (upstream->idle[i]);
+    upstream->idlecount = 0;
+}
+
+int housecgi_proxy_declare (const char *name, const char *uri,
+                            const char *socket, int protocol) {
+
+    int i = housecgi_proxy_search (name);
+
+    if (i < 0) {
+        if (CgiUpstreamsCount >= CgiUpstreamsSize) {
+            CgiUpstreamsSize += 4;
+            CgiUpstreams = realloc (CgiUpstreams,
+                                    CgiUpstreamsSize*sizeof(CgiUpstream));
+        }
+        i = CgiUpstreamsCount++;
+        memset (CgiUpstreams+i, 0, sizeof(CgiUpstream));
+        CgiUpstreams[i].name = strdup(name);
+        CgiUpstreams[i].signature = echttp_hash_signature (name);
+    } else {
+        housecgi_proxy_flush (CgiUpstreams+i);
+        if (CgiUpstreams[i].uri) free (CgiUpstreams[i].uri);
+        if (CgiUpstreams[i].socket) free (CgiUpstreams[i].socket);
+    }
+    CgiUpstreams[i].uri = strdup (uri);
+    CgiUpstreams[i].socket = strdup (socket);
+    CgiUpstreams[i].protocol = protocol;
+    return i;
+}
+
+static void housecgi_proxy_append (const char *data, int length) {
+
+    if (CgiProxyRequestLength + length >= CgiProxyRequestSize) {
+        CgiProxyRequestSize = CgiProxyRequestLength + length + 4096;
+        CgiProxyRequest = realloc (CgiProxyRequest, CgiProxyRequestSize);
+    }
+    memcpy (CgiProxyRequest + CgiProxyRequestLength, data, length);
+    CgiProxyRequestLength += length;
+}
+
+static void housecgi_proxy_appendtext (const char *text) {
+    housecgi_proxy_append (text, strlen(text));
+}
+
+static void housecgi_proxy_scgi (const char *name, const char *value) {
+
+    // CONTENT_LENGTH is always provided first, as required by SCGI.
+    if (!strcmp (name, "CONTENT_LENGTH")) return;
+    housecgi_proxy_append (name, strlen(name)+1);
+    housecgi_proxy_append (value, strlen(value)+1);
+}
+
+static void housecgi_proxy_build_scgi (CgiUpstream *upstream,
+                                       const char *method, const char *uri,
+                                       const char *data, int length) {
+
+    // The header is built after a placeholder for the netstring length,
+    // which is then inserted in front once the header length is known.
+    static const int reserved = 16;
+    char ascii[32];
+
+    CgiProxyRequestLength = 0;
+    housecgi_proxy_append ("                ", reserved);
+
+    snprintf (ascii, sizeof(ascii), "%d", (length > 0)?length:0);
+    housecgi_proxy_append ("CONTENT_LENGTH", 15);
+    housecgi_proxy_append (ascii, strlen(ascii)+1);
+    housecgi_proxy_append ("SCGI", 5);
+    housecgi_proxy_append ("1", 2);
+    housecgi_execute_variables (upstream->uri, "", method, uri,
+                                housecgi_proxy_scgi);
+    housecgi_proxy_append (",", 1);
+
+    int netlength = CgiProxyRequestLength - reserved - 1;
+    int prefix = snprintf (ascii, sizeof(ascii), "%d:", netlength);
+    memcpy (CgiProxyRequest + reserved - prefix, ascii, prefix);
+    memmove (CgiProxyRequest, CgiProxyRequest + reserved - prefix,
+             CgiProxyRequestLength - reserved + prefix);
+    CgiProxyRequestLength -= (reserved - prefix);
+
+    if (length > 0) housecgi_proxy_append (data, length);
+}
+
+static void housecgi_proxy_header (const char *name) {
+    const char *value = echttp_attribute_get (name);
+    if (!value) return;
+    housecgi_proxy_appendtext (name);
+    housecgi_proxy_appendtext (": ");
+    housecgi_proxy_appendtext (value);
+    housecgi_proxy_appendtext ("\r\n");
+}
+
+static void housecgi_proxy_build_http (CgiUpstream *upstream,
+                                       const char *method, const char *uri,
+                                       const char *data, int length) {
+
+    static const char *forwarded[] = {
+        "Accept",
+        "Accept-Encoding",
+        "Accept-Language",
+        "Authorization",
+        "Content-Type",
+        "Cookie",
+        "Git-Protocol",
+        "If-Modified-Since",
+        "If-None-Match",
+        "Referer",
+        "User-Agent",
+        0
+    };
+
+    const char *path = uri + strlen(upstream->uri);
+    if (!*path) path = "/";
+
+    char query[1024];
+    echttp_parameter_join (query, sizeof(query));
+
+    CgiProxyRequestLength = 0;
+    housecgi_proxy_appendtext (method);
+    housecgi_proxy_appendtext (" ");
+    housecgi_proxy_appendtext (path);
+    if (query[0]) {
+        housecgi_proxy_appendtext ("?");
+        housecgi_proxy_appendtext (query);
+    }
+    housecgi_proxy_appendtext (" HTTP/1.1\r\nHost: localhost\r\n"
+                               "X-Forwarded-Prefix: ");
+    housecgi_proxy_appendtext (upstream->uri);
+    housecgi_proxy_appendtext ("\r\n");
+
+    int i;
+    for (i = 0; forwarded[i]; ++i) housecgi_proxy_header (forwarded[i]);
+
+    if (length > 0) {
+        char ascii[64];
+        snprintf (ascii, sizeof(ascii), "Content-Length: %d\r\n", length);
+        housecgi_proxy_appendtext (ascii);
+    }
+    housecgi_proxy_appendtext ("\r\n");
+    if (length > 0) housecgi_proxy_append (data, length);
+}
+
+static int housecgi_proxy_connect (CgiUpstream *upstream, int *reused) {
+
+    // First try to reuse an idle connection, if it was not closed.
+    while (upstream->idlecount > 0) {
+        int fd = upstream->idle[--(upstream->idlecount)];
+        struct pollfd idle = {fd, POLLIN, 0};
+        if (poll (&idle, 1, 0) == 0) {
+            *reused = 1;
+            return fd;
+        }
+        close (fd); // Closed by the server, or unexpected data.
+    }
+    *reused = 0;
+
+    struct sockaddr_un address;
+    memset (&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strtcpy (address.sun_path, upstream->socket, sizeof(address.sun_path));
+
+    int fd = socket (AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect (fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        close (fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int housecgi_proxy_send (int fd, const char *data, int length) {
+
+    while (length > 0) {
+        struct pollfd out = {fd, POLLOUT, 0};
+        if (poll (&out, 1, PROXY_TIMEOUT) <= 0) return -1;
+        int sent = send (fd, data, length, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            return -1;
+        }
+        data += sent;
+        length -= sent;
+    }
+    return 0;
+}
+
+// Append more data to the response buffer. Return the number of bytes
+// received, 0 on end of file, -1 on error or timeout.
+//
+static int housecgi_proxy_receive (CgiUpstream *upstream, int fd) {
+
+    if (upstream->size - upstream->length < 4096) {
+        if (upstream->size > (INT_MAX - 0x10000) / 2) return -1;
+        int size = (upstream->size * 2) + 0x10000;
+        char *response = realloc (upstream->response, size);
+        if (!response) return -1;
+        upstream->response = response;
+        upstream->size = size;
+    }
+    struct pollfd in = {fd, POLLIN, 0};
+    if (poll (&in, 1, PROXY_TIMEOUT) <= 0) return -1;
+
+    int length = read (fd, upstream->response + upstream->length,
+                       upstream->size - upstream->length - 1);
+    if (length > 0) {
+        housecgi_trace_mark (HOUSECGI_TRACE_FIRSTBYTE);
+        upstream->length += length;
+    }
+    upstream->response[upstream->length] = 0;
+    return length;
+}
+
+static const char *housecgi_proxy_error (int code, const char *text) {
+
+    static char message[1024];
+
+    snprintf (message, sizeof(message),
+              "<html><body>Sorry, your request failed: %s</body></html>", text);
+    echttp_content_type_html ();
+    echttp_error (code, text);
+    housecgi_capture_status (code);
+    return message;
+}
+
+// Find the end of the HTTP header, including the blank line. Return 0 if
+// the header is not complete yet.
+//
+static int housecgi_proxy_headerend (const char *data, int length) {
+    int i;
+    for (i = 1; i < length; ++i) {
+        if (data[i] != '\n') continue;
+        if (data[i-1] == '\n') return i + 1;
+        if ((i > 1) && (data[i-1] == '\r') && (data[i-2] == '\n')) return i+1;
+    }
+    return 0;
+}
+
+// Search the header for the specified field. The header is not modified.
+//
+static const char *housecgi_proxy_field (const char *header, int length,
+                                         const char *name) {
+    int namelength = strlen(name);
+    const char *line = header;
+    const char *end = header + length;
+    while (line < end) {
+        const char *eol = memchr (line, '\n', end - line);
+        if (!eol) break;
+        if ((eol - line > namelength) && (line[namelength] == ':') &&
+            (!strncasecmp (line, name, namelength))) {
+            const char *value = line + namelength + 1;
+            while ((*value == ' ') || (*value == '\t')) ++value;
+            return value;
+        }
+        line = eol + 1;
+    }
+    return 0;
+}
+
+// Decode a chunked body in place. The decoded body starts at offset start.
+// Return the decoded body length, or -1 on error.
+//
+static int housecgi_proxy_dechunk (CgiUpstream *upstream, int fd, int start) {
+
+    int r = start;
+    int w = start;
+    for (;;) {
+        char *eol = memchr (upstream->response + r, '\n',
+                            upstream->length - r);
+        if (!eol) {
+            if (housecgi_proxy_receive (upstream, fd) <= 0) return -1;
+            continue;
+        }
+        long size = strtol (upstream->response + r, 0, 16);
+        int data = (eol - upstream->response) + 1;
+        if ((size < 0) || (size > INT_MAX - data - 2)) return -1;
+        if (size == 0) {
+            // Last chunk. Skip the trailer until the blank line.
+            r = data;
+            for (;;) {
+                eol = memchr (upstream->response + r, '\n',
+                              upstream->length - r);
+                if (!eol) {
+                    if (housecgi_proxy_receive (upstream, fd) <= 0) return -1;
+                    continue;
+                }
+                int blank = (eol == upstream->response + r) ||
+                            ((eol == upstream->response + r + 1) &&
+                             (upstream->response[r] == '\r'));
+                r = (eol - upstream->response) + 1;
+                if (blank) return w - start;
+            }
+        }
+        while (upstream->length < data + size + 2) {
+            if (housecgi_proxy_receive (upstream, fd) <= 0) return -1;
+        }
+        memmove (upstream->response + w, upstream->response + data, size);
+        w += size;
+        r = data + size;
+        if (upstream->response[r] == '\r') r += 1;
+        if (upstream->response[r] == '\n') r += 1;
+    }
+}
+
+// Receive and decode an HTTP/1.1 response. Return the offset of the
+// content, or -1 on error. *keep is set if the connection can be reused.
+//
+// The response buffer may be reallocated while the body is received:
+// only offsets are kept across these reads.
+//
+static int housecgi_proxy_http (CgiUpstream *upstream, int fd,
+                                const char *method, int *keep) {
+
+    int headerend;
+    for (;;) {
+        headerend = housecgi_proxy_headerend (upstream->response,
+                                              upstream->length);
+        if (headerend > 0) break;
+        if (housecgi_proxy_receive (upstream, fd) <= 0) return -1;
+    }
+    const char *response = upstream->response;
+    if (strncmp (response, "HTTP/1.", 7)) return -1;
+
+    int status_line_end =
+        (const char *)memchr (response, '\n', headerend) - response;
+    int status = atoi (response + 9);
+    if ((status < 100) || (status > 599)) return -1;
+
+    int content = -1; // Unknown, read until end of connection.
+    int chunked = 0;
+    *keep = 1;
+
+    const char *field;
+    field = housecgi_proxy_field (response, headerend, "Content-Length");
+    if (field) content = atoi (field);
+    field = housecgi_proxy_field (response, headerend, "Transfer-Encoding");
+    if (field && (!strncasecmp (field, "chunked", 7))) chunked = 1;
+    field = housecgi_proxy_field (response, headerend, "Connection");
+    if (field && (!strncasecmp (field, "close", 5))) *keep = 0;
+
+    if ((!strcmp (method, "HEAD")) ||
+        (status < 200) || (status == 204) || (status == 304)) {
+        content = 0;
+        chunked = 0;
+    }
+
+    if (chunked) {
+        content = housecgi_proxy_dechunk (upstream, fd, headerend);
+        if (content < 0) return -1;
+        upstream->length = headerend + content;
+    } else if (content >= 0) {
+        if (content > INT_MAX - headerend) return -1;
+        while (upstream->length < headerend + content) {
+            if (housecgi_proxy_receive (upstream, fd) <= 0) return -1;
+        }
+        upstream->length = headerend + content; // Ignore any excess.
+    } else {
+        *keep = 0;
+        int length;
+        while ((length = housecgi_proxy_receive (upstream, fd)) > 0) ;
+        if (length < 0) return -1;
+    }
+    upstream->response[upstream->length] = 0;
+    housecgi_trace_mark (HOUSECGI_TRACE_EXIT);
+
+    // Decode the status line, then the rest of the header the CGI way.
+    char *header = upstream->response;
+    header[status_line_end] = 0;
+    if ((status_line_end > 0) && (header[status_line_end-1] == '\r'))
+        header[status_line_end-1] = 0;
+    if (status != 200) {
+        const char *reason = strchr (header + 9, ' ');
+        echttp_error (status, reason ? reason + 1 : "Upstream status");
+        housecgi_capture_status (status);
+    }
+    int offset = status_line_end + 1;
+    housecgi_execute_header (header + offset, headerend - offset);
+    return headerend;
+}
+
+// Receive and decode an SCGI response, which is formatted like a CGI output.
+//
+static int housecgi_proxy_cgi (CgiUpstream *upstream, int fd) {
+
+    int length;
+    while ((length = housecgi_proxy_receive (upstream, fd)) > 0) ;
+    if (length < 0) return -1;
+    if (upstream->length <= 0) return -1;
+    housecgi_trace_mark (HOUSECGI_TRACE_EXIT);
+    return housecgi_execute_header (upstream->response, upstream->length);
+}
+
+const char *housecgi_proxy_forward (int id,
+                                    const char *method, const char *uri,
+                                    const char *data, int length) {
+
+    if ((id < 0) || (id >= CgiUpstreamsCount)) // Invalid server?
+        return housecgi_proxy_error (503, "No such CGI service");
+
+    CgiUpstream *upstream = CgiUpstreams + id;
+    upstream->total = 0;
+
+    if (upstream->protocol == HOUSECGI_PROXY_SCGI)
+        housecgi_proxy_build_scgi (upstream, method, uri, data, length);
+    else
+        housecgi_proxy_build_http (upstream, method, uri, data, length);
+
+    int attempt;
+    for (attempt = 0; attempt < 2; ++attempt) {
+        int reused;
+        int fd = housecgi_proxy_connect (upstream, &reused);
+        if (fd < 0) return housecgi_proxy_error (502, "Upstream unavailable");
+        housecgi_trace_mark (HOUSECGI_TRACE_LAUNCH);
+
+        int keep = 0;
+        int body = -1;
+        upstream->length = 0;
+        if (housecgi_proxy_send (fd,
+                                 CgiProxyRequest, CgiProxyRequestLength) == 0) {
+            housecgi_trace_mark (HOUSECGI_TRACE_STDIN);
+            if (upstream->protocol == HOUSECGI_PROXY_SCGI)
+                body = housecgi_proxy_cgi (upstream, fd);
+            else
+                body = housecgi_proxy_http (upstream, fd, method, &keep);
+        }
+        if (body < 0) {
+            close (fd);
+            // A reused connection may have been closed by the server
+            // meanwhile: retry once with a new connection.
+            if (reused && (upstream->length == 0)) continue;
+            return housecgi_proxy_error (502, "Upstream failure");
+        }
+        housecgi_trace_mark (HOUSECGI_TRACE_HEADER);
+
+        if (keep && (upstream->idlecount < PROXY_POOL))
+            upstream->idle[upstream->idlecount++] = fd;
+        else
+            close (fd);
+
+        upstream->total = upstream->length - body;
+        if (upstream->total <= 0) return "";
+        echttp_content_length (upstream->total);
+        return upstream->response + body;
+    }
+    return housecgi_proxy_error (502, "Upstream failure");
+}
+
+int housecgi_proxy_size (int id) {
+    if ((id < 0) || (id >= CgiUpstreamsCount)) return 0;
+    return CgiUpstreams[id].total;
+}
@@ -0,0 +1,32 @@
+/* HouseCGI - A simple home web service to support CGI applications.
+ *
+ * Copyright 2025, Pascal Martin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ * housecgi_proxy.h - Forward requests to local SCGI or HTTP servers.
+ */
+
+#define HOUSECGI_PROXY_SCGI 1
+#define HOUSECGI_PROXY_HTTP 2
+
+int housecgi_proxy_declare (const char *name, const char *uri,
+                            const char *socket, int protocol);
+
+const char *housecgi_proxy_forward (int id,
+                                    const char *method, const char *uri,
+                                    const char *data, int length);
+int housecgi_proxy_size (int id);
@@ -29,15 +29,40 @@
  *
  * void housecgi_route_background (time_t now);
  *
- *    Search the cgi-bin directory for any executable. Each executable
+ *    Search the cgi-bin directories for any executable. Each executable
  *    is then registered with an URI based on the file name.
  *
+ *    The default cgi-bin directory is /var/lib/house/<instance>-bin. Other
+ *    directories can be specified using the -cgi-bin option, which can be
+ *    repeated:
+ *
+ *       -cgi-bin=PATH[:SERVICE[:USER]]
+ *
+ *    The SERVICE name is registered with HousePortal for this directory
+ *    (default: the instance name), and the applications in this directory
+ *    are executed as USER (default: the user running housecgi). If the same
+ *    application name appears in multiple directories, the first directory
+ *    wins.
+ *
+ *    The cgi-bin directory may also contain <name>.scgi or <name>.http
+ *    descriptor files, which contain the path of the Unix socket of a
+ *    local server. The requests to these applications are forwarded to
+ *    the server, using the SCGI or HTTP protocol respectively.
+ *
  *    This function should be called periodically to detect when an
  *    application was removed or added. It handle the HTPP routes.
  *
- * int housecgi_route_status (char *buffer, int size);
+ * const char *housecgi_route_service (int index);
  *
- *    Return the current status of this module in JSON format.
+ *    Return the name of the Nth service registered with HousePortal, or
+ *    null if there is no such service.
+ *
+ * void housecgi_route_status (time_t since);
+ *
+ *    Add the current status of this module to the JSON response being
+ *    built (see housecgi_json.c). If since is not 0, only the applications
+ *    that changed since that time are listed, followed by the names of all
+ *    the applications present.
  *
  * NOTE
  *
@@ -53,7 +78,9 @@
 #include <string.h>
 #include <strings.h>
 #include <time.h>
+#include <pwd.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 
 #include "echttp.h"
 #include "echttp_libc.h"
@@ -62,6 +89,21 @@
 
 #include "housecgi_route.h"
 #include "housecgi_execute.h"
+#include "housecgi_breaker.h"
+#include "housecgi_client.h"
+#include "housecgi_capture.h"
+#include "housecgi_git.h"
+#include "housecgi_json.h"
+#include "housecgi_priority.h"
+#include "housecgi_spool.h"
+#include "housecgi_store.h"
+#include "housecgi_usage.h"
+#include "housecgi_option.h"
+#include "housecgi_proxy.h"
+#include "housecgi_schedule.h"
+#include "housecgi_trace.h"
+#include "housecgi_warmup.h"
+#include "housecgi_worker.h"
 
 static int Debug = 0;
 
@@ -74,16 +116,38 @@ typedef struct {
     size_t urilength;
     char *fullpath;
     int executor;
+    int proxy;
+    int git;
+    int spool;
+    int shared;
+    int root;
     time_t started;
     char present;
 } CgiApplication;
 
+#define CGI_ROOTS_MAX 8
+
+#define CGI_APP_STATUS_MAX 0x4000
+
+typedef struct {
+    char *path;
+    char *service;
+    char *user;    // Run the applications as this user (0: no change).
+} CgiRoot;
+
+static CgiRoot CgiRoots[CGI_ROOTS_MAX];
+static int CgiRootsCount = 0;
+
+// The services registered with HousePortal, one per distinct root service.
+static char *CgiServices[CGI_ROOTS_MAX];
+static char *CgiPaths[CGI_ROOTS_MAX];
+static int CgiServicesCount = 0;
+
 static CgiApplication *CgiDirectory = 0;
 static int CgiDirectoryCount = 0;
 static int CgiDirectorySize = 0;
 
-static const char *CgiPath = "cgi:/cgi";
-static const char *CgiBinRoot = "/var/lib/house/%s-bin";
+static const char *CgiBinDefault = "/var/lib/house/%s-bin";
 
 static int CgiPollPeriod = 60;
 
@@ -119,15 +183,51 @@ static char *housecgi_route_index (const char *name) {
     return housecgi_route_format ("/%s/index.html", name);
 }
 
+// Decode a PATH[:SERVICE[:USER]] cgi-bin specification.
+//
+static void housecgi_route_root (const char *spec, const char *instance) {
+
+    if (CgiRootsCount >= CGI_ROOTS_MAX) {
+        fprintf (stderr, "Too many cgi-bin directories, %s ignored\n", spec);
+        return;
+    }
+    char *path = strdup (spec);
+    char *service = strchr (path, ':');
+    char *user = 0;
+    if (service) {
+        *(service++) = 0;
+        user = strchr (service, ':');
+        if (user) {
+            *(user++) = 0;
+            if (!user[0]) user = 0;
+        }
+    }
+    if ((!service) || (!service[0])) service = (char *)instance;
+
+    if (user && (!getpwnam (user))) {
+        fprintf (stderr, "Unknown user %s, %s ignored\n", user, path);
+        free (path);
+        return;
+    }
+    CgiRoot *root = CgiRoots + CgiRootsCount++;
+    root->path = path;
+    root->service = strdup (service);
+    root->user = user ? strdup (user) : 0;
+    DEBUG ("CGI directory %s (service %s, user %s)\n",
+           root->path, root->service, user ? user : "(default)");
+
+    int i;
+    for (i = 0; i < CgiServicesCount; ++i) {
+        if (!strcmp (CgiServices[i], root->service)) return;
+    }
+    CgiServices[CgiServicesCount] = root->service;
+    CgiPaths[CgiServicesCount] = housecgi_route_registration (root->service);
+    CgiServicesCount += 1;
+}
+
 void housecgi_route_initialize (const char *instance,
                                 int argc, const char **argv) {
 
-    // Expand the default root directory based on the instance name.
-    static char root[128];
-    snprintf (root, sizeof(root), CgiBinRoot, instance);
-    CgiBinRoot = root;
-    CgiPath = housecgi_route_registration (instance);
-
     int i;
     const char *value;
     for (i = 1; i < argc; ++i) {
@@ -135,11 +235,26 @@ void housecgi_route_initialize (const char *instance,
             CgiPollPeriod = atoi (value);
             if (CgiPollPeriod < 10) CgiPollPeriod = 10; // Self protect.
         } else if (echttp_option_match ("-cgi-bin=", argv[i], &value)) {
-            CgiBinRoot = value;
+            housecgi_route_root (value, instance);
         } else if (echttp_option_present ("-d", argv[i])) {
             Debug = 1;
         }
     }
+    if (!CgiServicesCount) {
+        // Expand the default root directory based on the instance name.
+        // This is also used if all the -cgi-bin options were invalid,
+        // so that the instance is always registered with HousePortal.
+        char root[128];
+        snprintf (root, sizeof(root), CgiBinDefault, instance);
+        housecgi_route_root (root, instance);
+    }
+    housecgi_option_initialize (argc, argv);
+    housecgi_capture_initialize (argc, argv);
+    housecgi_store_initialize (argc, argv);
+    housecgi_spool_initialize (argc, argv);
+    housecgi_usage_initialize (argc, argv);
+    housecgi_client_initialize (argc, argv);
+    housecgi_git_initialize (argc, argv);
     housecgi_execute_initialize (argc, argv);
 
     // Initial CGI applications discovery.
@@ -151,6 +266,7 @@ static const char *housecgi_route_error (const char *uri,
     static char message[1024];
 
     echttp_error (code, text);
+    housecgi_capture_status (code);
 
     snprintf (message, sizeof(message),
               "<html><body>Sorry, your request failed.<br>%s: %s</body></html>",
@@ -168,13 +284,137 @@ static const char *housecgi_route_handle (const char *method, const char *uri,
         if ((uri[CgiDirectory[i].urilength] != 0) &&
             (uri[CgiDirectory[i].urilength] != '/')) continue;
 
+        housecgi_trace_start (CgiDirectory[i].name, method, uri);
+        housecgi_capture_start ();
+        housecgi_worker_busy (CgiDirectory[i].shared, uri);
+
+        // The warm-up probes are not accounted for (see housecgi_warmup.c).
+        int probe = housecgi_warmup_probing ();
+        int stats = probe ? -1 : CgiDirectory[i].shared;
+
+        if (housecgi_worker_draining (CgiDirectory[i].shared)) {
+            housecgi_worker_idle (stats, 0);
+            const char *output = housecgi_route_error (uri, 503, "CGI draining");
+            housecgi_capture_record (method, uri, data, length, 0);
+            return output;
+        }
+
+        if (CgiDirectory[i].proxy >= 0) {
+            const char *output = housecgi_proxy_forward
+                (CgiDirectory[i].proxy, method, uri, data, length);
+            int size = housecgi_proxy_size (CgiDirectory[i].proxy);
+            housecgi_trace_mark (HOUSECGI_TRACE_QUEUED);
+            housecgi_worker_idle (stats, size);
+            housecgi_capture_record (method, uri, data, length, size);
+            return output;
+        }
+
+        // Some git requests can be answered without running the CGI.
+        if (CgiDirectory[i].git >= 0) {
+            const char *output = housecgi_git_lookup
+                (CgiDirectory[i].git, method, uri, data, length);
+            if (output) {
+                int size = housecgi_git_size ();
+                housecgi_trace_mark (HOUSECGI_TRACE_QUEUED);
+                housecgi_worker_idle (stats, size);
+                housecgi_capture_record (method, uri, data, length, size);
+                return output;
+            }
+        }
+
+        // A resumed download can be answered from the spool.
+        if (CgiDirectory[i].spool >= 0) {
+            const char *output =
+                housecgi_spool_lookup (CgiDirectory[i].spool, method, uri);
+            if (output) {
+                housecgi_trace_mark (HOUSECGI_TRACE_QUEUED);
+                housecgi_worker_idle (stats, 0);
+                housecgi_capture_record (method, uri, data, length, 0);
+                return output;
+            }
+        }
+
+        // Do not even try if this application keeps failing.
+        int retry = probe ? 0 : housecgi_breaker_enter (CgiDirectory[i].shared);
+        if (retry > 0) {
+            char seconds[16];
+            housecgi_worker_idle (stats, 0);
+            const char *output =
+                housecgi_route_error (uri, 503, "CGI unavailable");
+            snprintf (seconds, sizeof(seconds), "%d", retry);
+            echttp_attribute_set ("Retry-After", seconds);
+            housecgi_capture_record (method, uri, data, length, 0);
+            return output;
+        }
+
+        // Reject the request now if too many CGI children run: waiting
+        // would block this worker.
+        if (housecgi_schedule_enter (CgiDirectory[i].shared)) {
+            if (!probe) housecgi_breaker_cancel (CgiDirectory[i].shared);
+            housecgi_worker_idle (stats, 0);
+            const char *output = housecgi_route_error (uri, 503, "CGI busy");
+            echttp_attribute_set ("Retry-After", "1");
+            housecgi_capture_record (method, uri, data, length, 0);
+            return output;
+        }
+
         // Warning: the CGI child is executed in blocking mode.
         housecgi_execute_launch
             (CgiDirectory[i].executor, method, uri, data, length);
-
-        while (! housecgi_execute_wait (CgiDirectory[i].executor, 1)) ;
-
-        const char *output = housecgi_execute_output (CgiDirectory[i].executor);
+        housecgi_worker_running
+            (housecgi_execute_pid (CgiDirectory[i].executor), length);
+
+        // Stop the CGI early if the client went away: the output would be
+        // discarded anyway. This is checked once per second, and only for
+        // long running CGIs.
+        int client = housecgi_client_socket ();
+        time_t checked = time(0);
+        while (! housecgi_execute_wait (CgiDirectory[i].executor, 1)) {
+            time_t now = time(0);
+            if (now <= checked) continue;
+            checked = now;
+            housecgi_worker_progress
+                (housecgi_execute_size (CgiDirectory[i].executor));
+            if (housecgi_worker_killed ()) {
+                housecgi_execute_cancel (CgiDirectory[i].executor);
+                DEBUG ("CGI %s cancelled: killed\n", uri);
+            }
+            if (housecgi_client_gone (client)) {
+                housecgi_execute_cancel (CgiDirectory[i].executor);
+                DEBUG ("CGI %s cancelled: client left\n", uri);
+            }
+        }
+        housecgi_schedule_leave (CgiDirectory[i].shared,
+                                 housecgi_execute_timedout (CgiDirectory[i].executor),
+                                 probe);
+        housecgi_git_store (CgiDirectory[i].git, CgiDirectory[i].executor);
+        if (!probe)
+            housecgi_usage_record (CgiDirectory[i].shared, CgiDirectory[i].name, uri,
+                                   housecgi_execute_usage (CgiDirectory[i].executor),
+                                   housecgi_execute_exit (CgiDirectory[i].executor),
+                                   housecgi_execute_cancelled (CgiDirectory[i].executor));
+
+        const char *output =
+            housecgi_spool_store (CgiDirectory[i].spool, CgiDirectory[i].executor);
+        if (!output)
+            output = housecgi_execute_output (CgiDirectory[i].executor);
+        int size = housecgi_execute_size (CgiDirectory[i].executor);
+        int status = housecgi_execute_exit (CgiDirectory[i].executor);
+        if (probe) {
+            // Not accounted for.
+        } else if (! housecgi_execute_cancelled (CgiDirectory[i].executor)) {
+            int failed = (size <= 0) || WIFSIGNALED(status) ||
+                         (WIFEXITED(status) && WEXITSTATUS(status)) ||
+                         housecgi_execute_timedout (CgiDirectory[i].executor) ||
+                         (housecgi_capture_result () >= 500);
+            housecgi_breaker_leave (CgiDirectory[i].shared, failed);
+        } else {
+            housecgi_breaker_cancel (CgiDirectory[i].shared);
+        }
+        housecgi_trace_mark (HOUSECGI_TRACE_QUEUED);
+        housecgi_worker_idle (stats, size);
+        housecgi_capture_record (method, uri, data, length,
+                                 housecgi_execute_content (CgiDirectory[i].executor));
         if (output) return output;
         return "";
     }
@@ -196,81 +436,156 @@ static const char *housecgi_route_handleindex (const char *method,
     return housecgi_route_handle (method, baseuri, data, length);
 }
 
-void housecgi_route_background (time_t now) {
+static int housecgi_route_socket (const char *path, char *socket, int size) {
 
-    static char **CgiRegistration = 0;
-    static int CgiRegistrationCount = 0;
+    // The descriptor file contains the path of the server's Unix socket.
+    FILE *descriptor = fopen (path, "r");
+    if (!descriptor) return 0;
+    if (!fgets (socket, size, descriptor)) socket[0] = 0;
+    fclose (descriptor);
 
-    static time_t LastCall = 0;
+    char *eol = strchr (socket, '\n');
+    if (eol) *eol = 0;
+    return socket[0] == '/';
+}
 
-    int firstCall = 0;
-    int changed = 0;
-
-    if (now < LastCall + CgiPollPeriod) return;
-    if (!LastCall) firstCall = 1;
-    LastCall = now;
+static int housecgi_route_scan (int r, int firstCall) {
 
     int i;
     int j;
+    int changed = 0;
     struct dirent **files = 0;
     char fullpath[512];
     char webroot[640];
 
-    housecgi_execute_background (now);
-
-    for (j = 0; j < CgiDirectoryCount; ++j) {
-        CgiDirectory[j].present = 0;
-    }
+    const char *path = CgiRoots[r].path;
 
-    int n = scandir (CgiBinRoot, &files, 0, 0);
+    int n = scandir (path, &files, 0, 0);
     for (i = 0; i < n; i++) {
         struct dirent *ent = files[i];
         if (ent->d_name[0] == '.') continue; // Skip hidden entries.
         if (ent->d_type != DT_REG) continue;
-        snprintf (fullpath, sizeof(fullpath), "%s/%s", CgiBinRoot, ent->d_name);
+        snprintf (fullpath, sizeof(fullpath), "%s/%s", path, ent->d_name);
 
         struct stat filestat;
         if (stat (fullpath, &filestat)) continue; // No access.
-        if (!(filestat.st_mode & S_IXOTH)) continue; // Not executable.
 
         char canonical[512];
         strtcpy (canonical, ent->d_name, sizeof(canonical));
         char *ext = strrchr (canonical, '.');
-        if (ext) *ext = 0;
+        int protocol = 0;
+        if (ext) {
+            // A local server is described by a <name>.scgi or <name>.http
+            // file, which is not an executable.
+            if (!strcmp (ext, ".scgi")) protocol = HOUSECGI_PROXY_SCGI;
+            else if (!strcmp (ext, ".http")) protocol = HOUSECGI_PROXY_HTTP;
+            *ext = 0;
+        }
+        if ((!protocol) && (!(filestat.st_mode & S_IXOTH)))
+            continue; // Not executable.
 
         for (j = 0; j < CgiDirectoryCount; ++j) {
             if (!CgiDirectory[j].name) continue;
             if (!strcmp (canonical, CgiDirectory[j].name)) {
-                CgiDirectory[j].present = 1;
+                // When present in two directories, the first one wins.
+                if (CgiDirectory[j].root == r) {
+                    CgiDirectory[j].present = 1;
+                    housecgi_warmup_check (CgiDirectory[j].shared, &filestat);
+                }
                 break;
             }
         }
         if (j >= CgiDirectoryCount) { // New CGI application.
+            char socket[256];
+            if (protocol &&
+                (!housecgi_route_socket (fullpath, socket, sizeof(socket))))
+                continue; // Invalid descriptor.
             j = housecgi_route_new ();
             CgiDirectory[j].present = 1;
+            CgiDirectory[j].root = r;
             CgiDirectory[j].name = strdup (canonical);
             CgiDirectory[j].fullpath = strdup (fullpath);
             CgiDirectory[j].uri = housecgi_route_uri (canonical);
             CgiDirectory[j].index = housecgi_route_index (canonical);
             CgiDirectory[j].urilength = strlen (CgiDirectory[j].uri);
             CgiDirectory[j].started = time(0);
+            CgiDirectory[j].shared = housecgi_worker_app (canonical);
+            housecgi_schedule_declare (CgiDirectory[j].shared, canonical);
+            housecgi_breaker_declare (CgiDirectory[j].shared, canonical);
             echttp_route_match (CgiDirectory[j].uri, housecgi_route_handle);
             echttp_route_uri (CgiDirectory[j].index, housecgi_route_handleindex);
             snprintf (webroot, sizeof(webroot),
                       "/usr/local/share/house/public/%s", canonical);
-            CgiDirectory[j].executor =
-                housecgi_execute_declare (CgiDirectory[j].name,
-                                          CgiDirectory[j].uri,
-                                          CgiDirectory[j].fullpath, webroot);
+            CgiDirectory[j].git = -1;
+            CgiDirectory[j].spool = -1;
+            if (protocol) {
+                CgiDirectory[j].executor = -1;
+                CgiDirectory[j].proxy =
+                    housecgi_proxy_declare (CgiDirectory[j].name,
+                                            CgiDirectory[j].uri,
+                                            socket, protocol);
+            } else {
+                CgiDirectory[j].proxy = -1;
+                CgiDirectory[j].executor =
+                    housecgi_execute_declare (CgiDirectory[j].name,
+                                              CgiDirectory[j].uri,
+                                              CgiDirectory[j].fullpath,
+                                              webroot);
+                if (CgiRoots[r].user)
+                    housecgi_execute_user (CgiDirectory[j].executor,
+                                           CgiRoots[r].user);
+                housecgi_execute_priority
+                    (CgiDirectory[j].executor,
+                     housecgi_priority_declare (CgiDirectory[j].shared,
+                                                CgiDirectory[j].name));
+                CgiDirectory[j].git =
+                    housecgi_git_declare (CgiDirectory[j].name,
+                                          CgiDirectory[j].uri);
+                CgiDirectory[j].spool =
+                    housecgi_spool_declare (CgiDirectory[j].name);
+                housecgi_warmup_declare (CgiDirectory[j].shared,
+                                         CgiDirectory[j].name,
+                                         CgiDirectory[j].fullpath,
+                                         CgiDirectory[j].uri, &filestat);
+            }
             if (!firstCall) {
                 houselog_event ("CGI", CgiDirectory[j].name, "ACTIVATED",
-                                "EXECUTABLE %s", CgiDirectory[j].fullpath);
+                                "%s %s",
+                                protocol ? "SERVER" : "EXECUTABLE",
+                                CgiDirectory[j].fullpath);
             }
             changed = 1;
         }
         free (ent);
     }
     if (files) free (files);
+    return changed;
+}
+
+void housecgi_route_background (time_t now) {
+
+    static char **CgiRegistration = 0;
+    static int CgiRegistrationCount = 0;
+
+    static time_t LastCall = 0;
+
+    int firstCall = 0;
+    int changed = 0;
+
+    if (now < LastCall + CgiPollPeriod) return;
+    if (!LastCall) firstCall = 1;
+    LastCall = now;
+
+    int j;
+
+    housecgi_execute_background (now);
+
+    for (j = 0; j < CgiDirectoryCount; ++j) {
+        CgiDirectory[j].present = 0;
+    }
+    for (j = 0; j < CgiRootsCount; ++j) {
+        changed |= housecgi_route_scan (j, firstCall);
+    }
 
     // Eliminate those entries when the application is no longer present.
     for (j = 0; j < CgiDirectoryCount; ++j) {
@@ -279,6 +594,7 @@ void housecgi_route_background (time_t now) {
         houselog_event ("CGI", CgiDirectory[j].name, "REMOVED",
                         "EXECUTABLE %s", CgiDirectory[j].fullpath);
         echttp_route_remove (CgiDirectory[j].uri);
+        housecgi_warmup_forget (CgiDirectory[j].shared);
         free (CgiDirectory[j].name);
         CgiDirectory[j].name = 0;
         free (CgiDirectory[j].uri);
@@ -292,10 +608,14 @@ void housecgi_route_background (time_t now) {
 
     if ((!firstCall) && (!changed)) return; // Nothing more to do.
 
+    // Only one worker registers with HousePortal, on behalf of all.
+    if (!housecgi_worker_primary()) return;
+
     // Re-register the new list to HousePortal and update the echttp
     // route list if necessary..
     //
-    houseportal_declare (echttp_port(4), &CgiPath, 1);
+    houseportal_declare (echttp_port(4),
+                         (const char **)CgiPaths, CgiServicesCount);
 
     for (j = 0; j < CgiRegistrationCount; ++j) {
         free (CgiRegistration[j]);
@@ -324,28 +644,99 @@ void housecgi_route_background (time_t now) {
     }
 }
 
-int housecgi_route_status (char *buffer, int size) {
+const char *housecgi_route_service (int index) {
+    if ((index < 0) || (index >= CgiServicesCount)) return 0;
+    return CgiServices[index];
+}
 
-    const char *sep = "[";
-    int cursor = snprintf (buffer, size, "\"routes\":");
+// Return the status of one application, as a JSON object.
+//
+static int housecgi_route_app_status (int i, char *buffer, int size) {
+
+    char name[256];
+    char uri[512];
+    char path[1024];
+    int cursor = snprintf (buffer, size,
+                           "{\"service\":\"%s\",\"uri\":\"%s\""
+                               ",\"path\":\"%s\",\"start\":%lld"
+                               ",\"requests\":%lld,\"max\":%d",
+                           housecgi_json_escape (name, sizeof(name),
+                                                 CgiDirectory[i].name),
+                           housecgi_json_escape (uri, sizeof(uri),
+                                                 CgiDirectory[i].uri),
+                           housecgi_json_escape (path, sizeof(path),
+                                                 CgiDirectory[i].fullpath),
+                           (long long)CgiDirectory[i].started,
+                           housecgi_worker_requests(CgiDirectory[i].shared),
+                           housecgi_worker_max(CgiDirectory[i].shared));
     if (cursor >= size) return 0;
+    const char *user = CgiRoots[CgiDirectory[i].root].user;
+    if (user) {
+        char text[256];
+        cursor += snprintf (buffer+cursor, size-cursor, ",\"user\":\"%s\"",
+                            housecgi_json_escape (text, sizeof(text), user));
+        if (cursor >= size) return 0;
+    }
+    if (housecgi_worker_draining (CgiDirectory[i].shared)) {
+        cursor += snprintf (buffer+cursor, size-cursor, ",\"draining\":true");
+        if (cursor >= size) return 0;
+    }
+    if (CgiDirectory[i].proxy < 0) {
+        cursor += housecgi_schedule_app_status
+                      (CgiDirectory[i].shared, buffer+cursor, size-cursor);
+        cursor += housecgi_usage_app_status
+                      (CgiDirectory[i].shared, buffer+cursor, size-cursor);
+        cursor += housecgi_priority_app_status
+                      (CgiDirectory[i].shared, buffer+cursor, size-cursor);
+        cursor += housecgi_breaker_app_status
+                      (CgiDirectory[i].shared, buffer+cursor, size-cursor);
+        cursor += housecgi_warmup_app_status
+                      (CgiDirectory[i].shared, buffer+cursor, size-cursor);
+    }
+    cursor += snprintf (buffer+cursor, size-cursor, "}");
+    if (cursor >= size) return 0;
+    return cursor;
+}
+
+void housecgi_route_status (time_t since) {
+
+    const char *sep = "";
+    housecgi_json_add ("\"routes\":[");
 
     int i;
     for (i = 0; i < CgiDirectoryCount; ++i) {
         if (!CgiDirectory[i].present) continue;
-        cursor += snprintf (buffer+cursor, size-cursor,
-                            "%s{\"service\":\"%s\",\"uri\":\"%s\""
-                                ",\"path\":\"%s\",\"start\":%lld,\"max\":%d}",
-                            sep, CgiDirectory[i].name, CgiDirectory[i].uri,
-                            CgiDirectory[i].fullpath,
-                            (long long)CgiDirectory[i].started,
-                            housecgi_execute_max(CgiDirectory[i].executor));
-        if (cursor >= size) return 0;
+        if (since && (CgiDirectory[i].started < since) &&
+            (housecgi_worker_updated (CgiDirectory[i].shared) < since)) continue;
+
+        char *buffer = housecgi_json_reserve (CGI_APP_STATUS_MAX);
+        if (!buffer) break;
+        int length = strlen (sep);
+        memcpy (buffer, sep, length);
+        int cursor = housecgi_route_app_status
+                         (i, buffer+length, CGI_APP_STATUS_MAX-length);
+        if (cursor <= 0) { // Too large, skip it.
+            housecgi_json_commit (0);
+            continue;
+        }
+        housecgi_json_commit (length + cursor);
         sep = ",";
     }
-
-    cursor += snprintf (buffer+cursor, size-cursor, "]");
-    if (cursor >= size) return 0;
-    return cursor;
+    housecgi_json_add ("]");
+
+    // The applications not listed above are still present, but unchanged.
+    if (since) {
+        sep = "";
+        housecgi_json_add (",\"present\":[");
+        for (i = 0; i < CgiDirectoryCount; ++i) {
+            if (!CgiDirectory[i].present) continue;
+            char name[256];
+            housecgi_json_add ("%s\"%s\"", sep,
+                               housecgi_json_escape (name, sizeof(name),
+                                                     CgiDirectory[i].name));
+            sep = ",";
+        }
+        housecgi_json_add ("]");
+    }
 }
 
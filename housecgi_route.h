@@ -22,5 +22,6 @@
 void housecgi_route_initialize (const char *instance,
                                 int argc, const char **argv);
 void housecgi_route_background (time_t now);
-int  housecgi_route_status (char *buffer, int size);
+const char *housecgi_route_service (int index);
+void housecgi_route_status (time_t since);
 
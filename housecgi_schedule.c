@@ -0,0 +1,550 @@
+/* HouseCGI - A simple home web service to support CGI applications.
+ *
+ * Copyright 2025, Pascal Martin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ * housecgi_schedule.c - Share the CGI executions fairly between apps.
+ *
+ * This module limits the number of CGI children running at the same time,
+ * over all workers (option -cgi-max=N, default is no limit). A request is
+ * never kept waiting, since its worker could not do anything else: if the
+ * request cannot run now, it is rejected and the client is asked to retry.
+ *
+ * Each active application gets a share of the -cgi-max limit proportional
+ * to its weight. An application is active if it is running requests, or
+ * if one of its requests was rejected recently. Beyond its share, an
+ * application may only use the slots that the other active applications
+ * do not need to reach their own share.
+ *
+ * Applications are also assigned a priority class: "interactive", "normal"
+ * (the default) or "bulk". A few slots are reserved for the higher priority
+ * classes: the normal applications cannot use the last eighth of the
+ * -cgi-max limit, and the bulk applications cannot use the last quarter.
+ *
+ * The weight and class are per application options, for example:
+ *
+ *    -cgi-option=cgit:class=interactive,weight=4
+ *
+ * In addition, an application can be given its own concurrency limit,
+ * using the "limit=N" application option. With "limit=adaptive", the
+ * limit starts at the number of workers and is adjusted automatically
+ * based on the observed launch to exit latency (AIMD). The latency is
+ * measured over windows of LIMIT_WINDOW requests, using the median of
+ * each window so that a few slow requests do not count. The limit is
+ * raised slowly while the median stays close to the baseline, i.e. the
+ * lowest median observed recently. It is cut when the median remains
+ * inflated for LIMIT_SUSTAINED windows in a row, or when a CGI times
+ * out. Without the limit option, an application may use all workers.
+ *
+ * Since each worker executes one request at a time, each worker runs
+ * at most one request: the running requests are tracked using worker
+ * tickets kept in memory shared by all workers, so that the slot of
+ * a worker that died can be recovered.
+ *
+ * void housecgi_schedule_initialize (int argc, const char **argv);
+ *
+ *    Initialize this module. This must be called before the workers
+ *    are forked.
+ *
+ * void housecgi_schedule_declare (int app, const char *name);
+ *
+ *    Load the scheduling options for the specified application.
+ *
+ * int  housecgi_schedule_enter (int app);
+ *
+ *    Return 0 if the application is allowed to execute now, -1 if the
+ *    request must be rejected. This never waits.
+ *
+ * void housecgi_schedule_leave (int app, int failed, int probe);
+ *
+ *    Release the execution slot used by this worker. The failed flag
+ *    indicates that the CGI child timed out. The probe flag indicates
+ *    a synthetic request, which does not adjust the concurrency limit.
+ *
+ * void housecgi_schedule_abandon (int worker);
+ *
+ *    Release the resources held by a worker that died.
+ *
+ * int  housecgi_schedule_status (char *buffer, int size);
+ *
+ *    Return the global state of the scheduler in JSON format. This
+ *    includes the response times of each priority class, so that
+ *    the effect of the bulk applications on the interactive ones
+ *    can be observed. Return -1 if the buffer is too small.
+ *
+ * int  housecgi_schedule_app_status (int app, char *buffer, int size);
+ *
+ *    Return the scheduler state for one application, as JSON fields
+ *    meant to be inserted in the application's object. The text starts
+ *    with a comma.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "echttp.h"
+
+#include "housecgi_option.h"
+#include "housecgi_schedule.h"
+#include "housecgi_stat.h"
+#include "housecgi_worker.h"
+
+#define CGI_CLASSES 3
+
+static const char *CgiClassName[CGI_CLASSES] = {
+    "interactive", "normal", "bulk"
+};
+
+#define TICKET_IDLE    0
+#define TICKET_RUNNING 1
+
+typedef struct {
+    int state;
+    int app;
+    long long granted; // Nanoseconds, monotonic.
+} CgiScheduleTicket;
+
+// An application remains active for SCHEDULE_DEMAND seconds after
+// one of its requests was rejected.
+#define SCHEDULE_DEMAND 2
+
+#define LIMIT_HISTORY 16
+
+// The latency is evaluated once every LIMIT_WINDOW requests. An inflated
+// latency is more than LIMIT_INFLATED times the baseline, and the limit
+// is cut only after LIMIT_SUSTAINED inflated windows in a row.
+#define LIMIT_WINDOW    16
+#define LIMIT_INFLATED  2.0
+#define LIMIT_SUSTAINED 3
+
+typedef struct {
+    time_t timestamp;
+    int limit;
+} CgiScheduleChange;
+
+typedef struct {
+    int weight;
+    int class;
+    int running;
+    long long dispatched;
+    long long rejected;
+    time_t refused;     // Last time a request was rejected.
+    double limit;
+    int adaptive;
+    int cooldown;       // Completions before a timeout can cut again.
+    int saturated;      // The limit was reached during this window.
+    int inflated;       // Consecutive inflated windows.
+    int samples;
+    long long sample[LIMIT_WINDOW]; // Microseconds.
+    long long baseline; // Microseconds, lowest recent median.
+    long long latency;  // Microseconds, median of the last window.
+    int changes;
+    CgiScheduleChange history[LIMIT_HISTORY];
+} CgiScheduleApp;
+
+typedef struct {
+    int32_t lock;
+    int  running;
+    long long rejected;
+    CgiScheduleTicket ticket[HOUSECGI_WORKERS_MAX];
+    CgiScheduleApp app[HOUSECGI_APPS_MAX];
+} CgiScheduleShared;
+
+static CgiScheduleShared *CgiSchedule = 0;
+static HouseCgiStat *CgiStat = 0;
+
+static int CgiScheduleMax = 0; // No limit.
+
+static long long housecgi_schedule_now (void) {
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return (now.tv_sec * 1000000000LL) + now.tv_nsec;
+}
+
+static void housecgi_schedule_lock (void) {
+    housecgi_stat_lock (&(CgiSchedule->lock));
+}
+
+static void housecgi_schedule_unlock (void) {
+    housecgi_stat_unlock (&(CgiSchedule->lock));
+}
+
+// Copy the state of an application to the statistics segment.
+// This is called with the scheduler lock held.
+//
+static void housecgi_schedule_publish (int app) {
+
+    CgiScheduleApp *shared = CgiSchedule->app + app;
+    housecgi_stat_begin ();
+    CgiStat->app[app].running = shared->running;
+    CgiStat->app[app].rejected = shared->rejected;
+    CgiStat->app[app].updated = time(0);
+    CgiStat->app[app].limit = (int)(shared->limit);
+    CgiStat->running = CgiSchedule->running;
+    CgiStat->rejected = CgiSchedule->rejected;
+    housecgi_stat_end ();
+}
+
+void housecgi_schedule_initialize (int argc, const char **argv) {
+
+    int i;
+    const char *value;
+    for (i = 1; i < argc; ++i) {
+        if (echttp_option_match ("-cgi-max=", argv[i], &value)) {
+            CgiScheduleMax = atoi (value);
+            if (CgiScheduleMax < 0) CgiScheduleMax = 0;
+        }
+    }
+
+    CgiSchedule = mmap (0, sizeof(CgiScheduleShared), PROT_READ|PROT_WRITE,
+                        MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if (CgiSchedule == MAP_FAILED) {
+        fprintf (stderr, "Cannot allocate shared memory\n");
+        exit (1);
+    }
+    for (i = 0; i < HOUSECGI_APPS_MAX; ++i) {
+        CgiSchedule->app[i].weight = 1;
+        CgiSchedule->app[i].class = 1;
+        CgiSchedule->app[i].limit = HOUSECGI_WORKERS_MAX;
+    }
+    CgiStat = housecgi_stat_initialize (0); // Normally already done.
+    CgiStat->max = CgiScheduleMax;
+}
+
+void housecgi_schedule_declare (int app, const char *name) {
+
+    if ((app < 0) || (app >= HOUSECGI_APPS_MAX)) return;
+
+    int weight = housecgi_option_integer (name, "weight", 1);
+    if (weight < 1) weight = 1;
+
+    int class = 1;
+    const char *value = housecgi_option_get (name, "class");
+    if (value) {
+        int i;
+        for (i = 0; i < CGI_CLASSES; ++i) {
+            if (!strcmp (value, CgiClassName[i])) class = i;
+        }
+    }
+    int adaptive = 0;
+    int limit = HOUSECGI_WORKERS_MAX;
+    value = housecgi_option_get (name, "limit");
+    if (value && (!strcmp (value, "adaptive"))) {
+        adaptive = 1;
+        limit = CgiStat->workers;
+        if ((CgiScheduleMax > 0) && (CgiScheduleMax < limit))
+            limit = CgiScheduleMax;
+    } else if (value && (atoi (value) > 0)) {
+        limit = atoi (value);
+    }
+    if (limit < 1) limit = 1;
+    if (limit > HOUSECGI_WORKERS_MAX) limit = HOUSECGI_WORKERS_MAX;
+
+    housecgi_schedule_lock ();
+    CgiScheduleApp *shared = CgiSchedule->app + app;
+    shared->weight = weight;
+    shared->class = class;
+    if ((!adaptive) || (!shared->adaptive)) {
+        shared->limit = limit; // Start over.
+        shared->samples = 0;
+        shared->saturated = 0;
+        shared->inflated = 0;
+    }
+    shared->adaptive = adaptive;
+    housecgi_schedule_publish (app);
+    housecgi_schedule_unlock ();
+}
+
+static int housecgi_schedule_active (const CgiScheduleApp *app, time_t now) {
+    return (app->running > 0) || (app->refused + SCHEDULE_DEMAND >= now);
+}
+
+// The share of an application is its part of the -cgi-max limit, in
+// proportion of its weight. It is never more than its own limit.
+//
+static int housecgi_schedule_share (const CgiScheduleApp *app, int weights) {
+    int share = (CgiScheduleMax * app->weight) / weights;
+    if (share < 1) share = 1;
+    if (share > (int)(app->limit)) share = (int)(app->limit);
+    return share;
+}
+
+// Decide if the application can run one more request now.
+//
+static int housecgi_schedule_admit (int a) {
+
+    CgiScheduleApp *app = CgiSchedule->app + a;
+    if (app->running >= (int)(app->limit)) return 0;
+    if (CgiScheduleMax <= 0) return 1;
+
+    // The last slots are kept for the higher priority classes.
+    int available = CgiScheduleMax - CgiSchedule->running;
+    int reserve = (CgiScheduleMax * app->class) / 8;
+    if (available <= reserve) return 0;
+
+    time_t now = time(0);
+    int weights = app->weight;
+    int i;
+    for (i = 0; i < HOUSECGI_APPS_MAX; ++i) {
+        if (i == a) continue;
+        if (housecgi_schedule_active (CgiSchedule->app + i, now))
+            weights += CgiSchedule->app[i].weight;
+    }
+    if (app->running < housecgi_schedule_share (app, weights)) return 1;
+
+    // Beyond its share, the application may only use the slots that
+    // the other applications, which requests were rejected recently,
+    // would need to reach their own share.
+    int needed = 0;
+    for (i = 0; i < HOUSECGI_APPS_MAX; ++i) {
+        if (i == a) continue;
+        const CgiScheduleApp *other = CgiSchedule->app + i;
+        if (other->refused + SCHEDULE_DEMAND < now) continue;
+        int missing = housecgi_schedule_share (other, weights) - other->running;
+        if (missing > 0) needed += missing;
+    }
+    return available > reserve + needed;
+}
+
+int housecgi_schedule_enter (int app) {
+
+    if ((app < 0) || (app >= HOUSECGI_APPS_MAX)) return 0; // Not scheduled.
+
+    CgiScheduleTicket *ticket =
+        CgiSchedule->ticket + housecgi_worker_index();
+    CgiScheduleApp *shared = CgiSchedule->app + app;
+    int result = 0;
+
+    housecgi_schedule_lock ();
+    if (housecgi_schedule_admit (app)) {
+        ticket->app = app;
+        ticket->granted = housecgi_schedule_now ();
+        ticket->state = TICKET_RUNNING;
+        shared->running += 1;
+        shared->dispatched += 1;
+        CgiSchedule->running += 1;
+    } else {
+        shared->rejected += 1;
+        shared->refused = time(0);
+        CgiSchedule->rejected += 1;
+        result = -1;
+    }
+    housecgi_schedule_publish (app);
+    housecgi_schedule_unlock ();
+    return result;
+}
+
+static void housecgi_schedule_change (CgiScheduleApp *app, double limit) {
+
+    if (limit < 1.0) limit = 1.0;
+    if (limit > HOUSECGI_WORKERS_MAX) limit = HOUSECGI_WORKERS_MAX;
+
+    int before = (int)(app->limit);
+    app->limit = limit;
+    if ((int)limit == before) return;
+
+    CgiScheduleChange *change = app->history + (app->changes % LIMIT_HISTORY);
+    change->timestamp = time(0);
+    change->limit = (int)limit;
+    app->changes += 1;
+}
+
+static long long housecgi_schedule_median (const CgiScheduleApp *app) {
+
+    long long sorted[LIMIT_WINDOW];
+    int i, j;
+    for (i = 0; i < app->samples; ++i) {
+        long long value = app->sample[i];
+        for (j = i; (j > 0) && (sorted[j-1] > value); --j)
+            sorted[j] = sorted[j-1];
+        sorted[j] = value;
+    }
+    return sorted[app->samples / 2];
+}
+
+// Adjust the application's concurrency limit based on the latency
+// of the request that just completed (AIMD).
+//
+static void housecgi_schedule_adapt (CgiScheduleApp *app,
+                                     long long latency, int failed) {
+
+    if (!app->adaptive) return;
+    if (app->cooldown > 0) app->cooldown -= 1;
+
+    if (failed) {
+        if (app->cooldown > 0) return; // Let the last cut take effect.
+        housecgi_schedule_change (app, app->limit * 0.75);
+        app->cooldown = (int)(app->limit) + 1;
+        app->samples = 0; // Measure again.
+        app->saturated = 0;
+        app->inflated = 0;
+        return;
+    }
+
+    // The latency tells something about a higher concurrency only
+    // when the limit was reached.
+    if (app->running + 1 >= (int)(app->limit)) app->saturated = 1;
+
+    app->sample[app->samples++] = latency;
+    if (app->samples < LIMIT_WINDOW) return;
+
+    app->latency = housecgi_schedule_median (app);
+    app->samples = 0;
+
+    // The baseline follows any lower median immediately, and drifts
+    // slowly toward higher medians so that it recovers from a stale
+    // low measurement.
+    if ((app->baseline <= 0) || (app->latency < app->baseline))
+        app->baseline = app->latency;
+    else
+        app->baseline += (app->latency - app->baseline) / 16;
+
+    if (app->latency > app->baseline * LIMIT_INFLATED) {
+        if (++(app->inflated) >= LIMIT_SUSTAINED) {
+            housecgi_schedule_change (app, app->limit * 0.75);
+            app->inflated = 0;
+        }
+    } else {
+        app->inflated = 0;
+        if (app->saturated)
+            housecgi_schedule_change (app, app->limit + 1.0);
+    }
+    app->saturated = 0;
+}
+
+void housecgi_schedule_leave (int app, int failed, int probe) {
+
+    if ((app < 0) || (app >= HOUSECGI_APPS_MAX)) return;
+
+    CgiScheduleTicket *ticket =
+        CgiSchedule->ticket + housecgi_worker_index();
+
+    housecgi_schedule_lock ();
+    if (ticket->state == TICKET_RUNNING) {
+        CgiScheduleApp *shared = CgiSchedule->app + app;
+        long long latency = (housecgi_schedule_now () - ticket->granted) / 1000;
+        shared->running -= 1;
+        CgiSchedule->running -= 1;
+        if (!probe) housecgi_schedule_adapt (shared, latency, failed);
+    }
+    ticket->state = TICKET_IDLE;
+    housecgi_schedule_publish (app);
+    housecgi_schedule_unlock ();
+}
+
+void housecgi_schedule_abandon (int worker) {
+
+    if ((worker < 0) || (worker >= HOUSECGI_WORKERS_MAX)) return;
+
+    CgiScheduleTicket *ticket = CgiSchedule->ticket + worker;
+
+    housecgi_schedule_lock ();
+    if (ticket->state == TICKET_RUNNING) {
+        CgiSchedule->app[ticket->app].running -= 1;
+        CgiSchedule->running -= 1;
+    }
+    ticket->state = TICKET_IDLE;
+    housecgi_schedule_publish (ticket->app);
+    housecgi_schedule_unlock ();
+}
+
+int housecgi_schedule_status (char *buffer, int size) {
+
+    int i;
+    int cursor = snprintf (buffer, size,
+                           "\"scheduler\":{\"max\":%d,\"running\":%d"
+                               ",\"rejected\":%lld,\"classes\":{",
+                           CgiScheduleMax, CgiSchedule->running,
+                           CgiSchedule->rejected);
+    if (cursor >= size) return -1;
+
+    // Merge the latency histograms of the applications in each class.
+    static uint32_t latency[CGI_CLASSES][HOUSECGI_LATENCY_BUCKETS];
+    long long count[CGI_CLASSES];
+    memset (latency, 0, sizeof(latency));
+    memset (count, 0, sizeof(count));
+    int a;
+    for (a = 0; (a < CgiStat->apps) && (a < HOUSECGI_APPS_MAX); ++a) {
+        int class = CgiSchedule->app[a].class;
+        for (i = 0; i < HOUSECGI_LATENCY_BUCKETS; ++i) {
+            latency[class][i] += CgiStat->app[a].latency[i];
+            count[class] += CgiStat->app[a].latency[i];
+        }
+    }
+    const char *sep = "";
+    int class;
+    for (class = 0; class < CGI_CLASSES; ++class) {
+        if (count[class] <= 0) continue;
+        cursor += snprintf (buffer+cursor, size-cursor,
+                            "%s\"%s\":{\"requests\":%lld"
+                                ",\"p50\":%.1f,\"p99\":%.1f}",
+                            sep, CgiClassName[class], count[class],
+                            housecgi_stat_percentile
+                                (latency[class], count[class], 0.5) / 1000.0,
+                            housecgi_stat_percentile
+                                (latency[class], count[class], 0.99) / 1000.0);
+        if (cursor >= size) return -1;
+        sep = ",";
+    }
+    cursor += snprintf (buffer+cursor, size-cursor, "}}");
+    if (cursor >= size) return -1;
+    return cursor;
+}
+
+int housecgi_schedule_app_status (int app, char *buffer, int size) {
+
+    if ((app < 0) || (app >= HOUSECGI_APPS_MAX)) return 0;
+
+    CgiScheduleApp *shared = CgiSchedule->app + app;
+
+    int cursor = snprintf (buffer, size,
+                           ",\"class\":\"%s\",\"weight\":%d"
+                               ",\"running\":%d,\"dispatched\":%lld"
+                               ",\"rejected\":%lld",
+                           CgiClassName[shared->class], shared->weight,
+                           shared->running, shared->dispatched,
+                           shared->rejected);
+    if (cursor >= size) return 0;
+
+    cursor += snprintf (buffer+cursor, size-cursor,
+                        ",\"limit\":{\"current\":%d,\"adaptive\":%s"
+                            ",\"baseline\":%lld,\"latency\":%lld"
+                            ",\"history\":",
+                        (int)(shared->limit), shared->adaptive ? "true" : "false",
+                        shared->baseline / 1000, shared->latency / 1000);
+    if (cursor >= size) return 0;
+
+    // List the most recent changes, oldest first.
+    const char *sep = "[";
+    int i = shared->changes - LIMIT_HISTORY;
+    if (i < 0) i = 0;
+    for (; i < shared->changes; ++i) {
+        const CgiScheduleChange *change = shared->history + (i % LIMIT_HISTORY);
+        cursor += snprintf (buffer+cursor, size-cursor, "%s[%lld,%d]",
+                            sep, (long long)change->timestamp, change->limit);
+        if (cursor >= size) return 0;
+        sep = ",";
+    }
+    if (sep[0] == '[') cursor += snprintf (buffer+cursor, size-cursor, "[");
+    cursor += snprintf (buffer+cursor, size-cursor, "]}");
+    if (cursor >= size) return 0;
+    return cursor;
+}
@@ -0,0 +1,31 @@
+/* HouseCGI - A simple home web service to support CGI applications.
+ *
+ * Copyright 2025, Pascal Martin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ * housecgi_schedule.h - Share the CGI executions fairly between apps.
+ */
+
+void housecgi_schedule_initialize (int argc, const char **argv);
+void housecgi_schedule_declare (int app, const char *name);
+
+int  housecgi_schedule_enter (int app);
+void housecgi_schedule_leave (int app, int failed, int probe);
+void housecgi_schedule_abandon (int worker);
+
+int  housecgi_schedule_status (char *buffer, int size);
+int  housecgi_schedule_app_status (int app, char *buffer, int size);
@@ -0,0 +1,158 @@
+/* HouseCGI - A simple home web service to support CGI applications.
+ *
+ * Copyright 2025, Pascal Martin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ * housecgi_sensor.c - Publish the CGI performance as sensor data.
+ *
+ * This module periodically publishes, for each application that received
+ * requests, the request rate, the median (p50) and p99 response times,
+ * the percentage of errors (5xx status) and the throughput, using the
+ * HouseLog sensor API. These are calculated from the counters kept by
+ * all workers in the statistics segment, over a window of -cgi-sensor=N
+ * seconds (default 300, 0 disables the sensor data).
+ *
+ * Only the primary worker publishes sensor data.
+ *
+ * void housecgi_sensor_initialize (const char *instance,
+ *                                  int argc, const char **argv);
+ *
+ *    Initialize this module.
+ *
+ * void housecgi_sensor_background (time_t now);
+ *
+ *    Publish the sensor data at the end of each window.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "echttp.h"
+#include "houselog_sensor.h"
+
+#include "housecgi_sensor.h"
+#include "housecgi_stat.h"
+#include "housecgi_worker.h"
+
+static HouseCgiStat *CgiStat = 0;
+
+static int CgiSensorWindow = 300;
+static time_t CgiSensorStart = 0;
+
+static HouseCgiStatApp CgiSensorLast[HOUSECGI_APPS_MAX];
+static int CgiSensorLastCount = 0;
+
+static const HouseCgiStatApp CgiSensorNew; // Declared during the window.
+
+// Find the previous counters of an application. The slots are matched
+// by name, since a slot may be reused for another application.
+//
+static const HouseCgiStatApp *housecgi_sensor_last (int i, const char *name) {
+
+    if ((i < CgiSensorLastCount) && (!strcmp (CgiSensorLast[i].name, name)))
+        return CgiSensorLast + i;
+
+    for (i = 0; i < CgiSensorLastCount; ++i) {
+        if (!strcmp (CgiSensorLast[i].name, name)) return CgiSensorLast + i;
+    }
+    return &CgiSensorNew;
+}
+
+void housecgi_sensor_initialize (const char *instance,
+                                 int argc, const char **argv) {
+
+    int i;
+    const char *value;
+    for (i = 1; i < argc; ++i) {
+        if (echttp_option_match ("-cgi-sensor=", argv[i], &value)) {
+            CgiSensorWindow = atoi (value);
+        }
+    }
+    CgiStat = housecgi_stat_initialize (0); // Normally already done.
+    if (CgiSensorWindow > 0) houselog_sensor_initialize (instance, argc, argv);
+}
+
+static void housecgi_sensor_publish (const struct timeval *timestamp,
+                                     const HouseCgiStatApp *app,
+                                     const HouseCgiStatApp *last,
+                                     int elapsed) {
+
+    long long requests = app->requests - last->requests;
+    if (requests <= 0) return; // Nothing to report, or counters were reset.
+    if ((app->errors < last->errors) || (app->bytes < last->bytes)) return;
+
+    uint32_t latency[HOUSECGI_LATENCY_BUCKETS];
+    long long count = 0;
+    int i;
+    for (i = 0; i < HOUSECGI_LATENCY_BUCKETS; ++i) {
+        latency[i] = app->latency[i] - last->latency[i]; // Wraps around.
+        count += latency[i];
+    }
+
+    char value[32];
+    snprintf (value, sizeof(value), "%.2f", (double)requests / elapsed);
+    houselog_sensor_data (timestamp, app->name, "rate", value, "req/s");
+
+    if (count > 0) {
+        snprintf (value, sizeof(value), "%.1f",
+                  housecgi_stat_percentile (latency, count, 0.5) / 1000.0);
+        houselog_sensor_data (timestamp, app->name, "p50", value, "ms");
+        snprintf (value, sizeof(value), "%.1f",
+                  housecgi_stat_percentile (latency, count, 0.99) / 1000.0);
+        houselog_sensor_data (timestamp, app->name, "p99", value, "ms");
+    }
+
+    snprintf (value, sizeof(value), "%.1f",
+              100.0 * (app->errors - last->errors) / requests);
+    houselog_sensor_data (timestamp, app->name, "errors", value, "%");
+
+    houselog_sensor_numeric (timestamp, app->name, "throughput",
+                             (app->bytes - last->bytes) / elapsed, "B/s");
+}
+
+void housecgi_sensor_background (time_t now) {
+
+    if (CgiSensorWindow <= 0) return;
+    if (!housecgi_worker_primary()) return;
+    if (now < CgiSensorStart + CgiSensorWindow) return;
+
+    static HouseCgiStatApp current[HOUSECGI_APPS_MAX];
+
+    housecgi_stat_begin ();
+    int count = CgiStat->apps;
+    memcpy (current, CgiStat->app, count * sizeof(HouseCgiStatApp));
+    housecgi_stat_end ();
+
+    if (CgiSensorStart > 0) {
+        struct timeval timestamp;
+        gettimeofday (&timestamp, 0);
+        int elapsed = (int)(now - CgiSensorStart);
+        int i;
+        for (i = 0; i < count; ++i) {
+            const HouseCgiStatApp *last =
+                housecgi_sensor_last (i, current[i].name);
+            housecgi_sensor_publish (&timestamp, current + i, last, elapsed);
+        }
+        houselog_sensor_flush ();
+    }
+    memcpy (CgiSensorLast, current, count * sizeof(HouseCgiStatApp));
+    CgiSensorLastCount = count;
+    CgiSensorStart = now;
+}
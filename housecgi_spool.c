@@ -0,0 +1,441 @@
+/* HouseCGI - A simple home web service to support CGI applications.
+ *
+ * Copyright 2025, Pascal Martin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ * housecgi_spool.c - Serve byte ranges of spooled CGI responses.
+ *
+ * This module allows a client to resume an interrupted download without
+ * running the CGI application again. The complete responses to GET
+ * requests are kept in the disk store (see housecgi_store.c), keyed by
+ * application, URI and a signature of the query parameters. Each spooled
+ * response gets an ETag, the CGI's own if it provided one, and is
+ * advertised with "Accept-Ranges: bytes". A later GET request with a
+ * single byte Range is then answered from the spool with a 206 Partial
+ * Content response, sent using sendfile(). The If-Range condition is
+ * supported, both with an ETag and a Last-Modified date.
+ *
+ * A GET request without a Range always runs the CGI, and its response
+ * replaces the spooled one.
+ *
+ * This is enabled for a CGI application with the "spool[=N]" option,
+ * where N is how long a response remains valid, in seconds (default 3600).
+ * This option implies "memfd", and requires the store (-cgi-store).
+ * A response is spooled only if its status is 200, it does not have
+ * "Cache-Control: no-store" or "private", and its size is within the
+ * store's limit. A request with a Cookie or Authorization header is never
+ * spooled, nor answered from the spool.
+ *
+ * The CGI must run to completion before its response is spooled: an
+ * application that produces large downloads needs a "timeout=N" option
+ * long enough, since the default timeout (5 seconds) would kill it.
+ *
+ * void housecgi_spool_initialize (int argc, const char **argv);
+ *
+ *    Initialize this module.
+ *
+ * int  housecgi_spool_declare (const char *name);
+ *
+ *    Return an identifier if this CGI application uses the spool, or -1.
+ *
+ * const char *housecgi_spool_lookup (int id, const char *method,
+ *                                    const char *uri);
+ *
+ *    Answer a Range request from the spool. Return 0 if the CGI must
+ *    be executed.
+ *
+ * const char *housecgi_spool_store (int id, int executor);
+ *
+ *    Spool the response of the CGI that just completed. If the request
+ *    was a Range request, the range is sent from the spool and a non-null
+ *    value is returned. Otherwise the complete response is to be sent
+ *    as usual, and this returns 0.
+ *
+ * int  housecgi_spool_status (char *buffer, int size);
+ *
+ *    Return the spool statistics in JSON format.
+ *    Return -1 if the buffer is too small.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "echttp.h"
+#include "echttp_hash.h"
+
+#include "housecgi_spool.h"
+#include "housecgi_execute.h"
+#include "housecgi_option.h"
+#include "housecgi_store.h"
+
+#define SPOOL_HEADER_MAX 0x10000
+
+typedef struct {
+    char *name;
+    long long signature;
+    int ttl;
+} CgiSpoolApp;
+
+static CgiSpoolApp *CgiSpoolApps = 0;
+static int CgiSpoolAppsCount = 0;
+
+static int  CgiSpoolPending = -1;
+static int  CgiSpoolRange = 0; // The pending request has a Range.
+static char CgiSpoolPendingKey[1024];
+static char CgiSpoolPendingName[64];
+
+static char *CgiSpoolHeader = 0;
+
+static long long CgiSpoolHits = 0;
+static long long CgiSpoolMisses = 0;
+static long long CgiSpoolStored = 0;
+
+void housecgi_spool_initialize (int argc, const char **argv) {
+}
+
+int housecgi_spool_declare (const char *name) {
+
+    const char *ttl = housecgi_option_get (name, "spool");
+    if (!ttl) return -1;
+
+    CgiSpoolApps =
+        realloc (CgiSpoolApps, (CgiSpoolAppsCount+1) * sizeof(CgiSpoolApp));
+    CgiSpoolApps[CgiSpoolAppsCount].name = strdup (name);
+    CgiSpoolApps[CgiSpoolAppsCount].signature = echttp_hash_signature (name);
+    CgiSpoolApps[CgiSpoolAppsCount].ttl = ttl[0] ? atoi (ttl) : 3600;
+    return CgiSpoolAppsCount++;
+}
+
+// Find a header field in the CGI output. The value is copied to buffer.
+//
+static const char *housecgi_spool_field (const char *header, int length,
+                                         const char *name,
+                                         char *buffer, int size) {
+    int namelength = strlen (name);
+    const char *line = header;
+    const char *end = header + length;
+    while (line < end) {
+        const char *eol = memchr (line, '\n', end - line);
+        if (!eol) break;
+        int linelength = eol - line;
+        if ((linelength > 0) && (line[linelength-1] == '\r')) linelength -= 1;
+        if (linelength == 0) break; // End of the header.
+        if ((linelength > namelength) && (line[namelength] == ':') &&
+            (!strncasecmp (line, name, namelength))) {
+            const char *value = line + namelength + 1;
+            while ((*value == ' ') || (*value == '\t')) ++value;
+            int valuelength = (line + linelength) - value;
+            if (valuelength >= size) valuelength = size - 1;
+            memcpy (buffer, value, valuelength);
+            buffer[valuelength] = 0;
+            return buffer;
+        }
+        line = eol + 1;
+    }
+    return 0;
+}
+
+// Decode a single range "bytes=START-END", "bytes=START-" or "bytes=-N".
+// Return 1 if the range is valid, -1 if it cannot be satisfied, 0 if it
+// must be ignored (invalid syntax, multiple ranges).
+//
+static int housecgi_spool_range (const char *range, long long size,
+                                 long long *start, long long *end) {
+
+    if (strncmp (range, "bytes=", 6)) return 0;
+    range += 6;
+    if (strchr (range, ',')) return 0;
+
+    char *cursor;
+    if (range[0] == '-') {
+        long long suffix = strtoll (range + 1, &cursor, 10);
+        if (*cursor || (cursor == range + 1)) return 0;
+        if (suffix <= 0) return -1;
+        *start = (suffix < size) ? size - suffix : 0;
+        *end = size - 1;
+        return (size > 0) ? 1 : -1;
+    }
+    *start = strtoll (range, &cursor, 10);
+    if ((cursor == range) || (*cursor != '-')) return 0;
+    const char *last = cursor + 1;
+    if (*last) {
+        *end = strtoll (last, &cursor, 10);
+        if (*cursor || (*end < *start)) return 0;
+        if (*end >= size) *end = size - 1;
+    } else {
+        *end = size - 1;
+    }
+    if (*start >= size) return -1;
+    return 1;
+}
+
+// Send the pending range from the spooled response.
+//
+static const char *housecgi_spool_send (int id, const char *range) {
+
+    int fd = housecgi_store_open (CgiSpoolPendingName);
+    if (fd < 0) return 0;
+
+    struct stat filestat;
+    if (fstat (fd, &filestat)) {
+        close (fd);
+        return 0;
+    }
+    if (!CgiSpoolHeader) CgiSpoolHeader = malloc (SPOOL_HEADER_MAX + 1);
+    int length = pread (fd, CgiSpoolHeader, SPOOL_HEADER_MAX, 0);
+    int keylength = strlen (CgiSpoolPendingKey);
+    if ((length <= keylength) ||
+        memcmp (CgiSpoolHeader, CgiSpoolPendingKey, keylength) ||
+        (CgiSpoolHeader[keylength] != '\n')) {
+        close (fd); // Not the same request, after all.
+        return 0;
+    }
+    CgiSpoolHeader[length] = 0;
+
+    // The second line is the ETag and the time the response was spooled.
+    char *etag = CgiSpoolHeader + keylength + 1;
+    char *eol = strchr (etag, '\n');
+    if (!eol) {
+        close (fd);
+        return 0;
+    }
+    *eol = 0;
+    char *spooled = strchr (etag, ' ');
+    if (!spooled) {
+        close (fd);
+        return 0;
+    }
+    *(spooled++) = 0;
+    if (atoll (spooled) + CgiSpoolApps[id].ttl < time(0)) {
+        close (fd); // Too old.
+        return 0;
+    }
+    int start = (eol + 1) - CgiSpoolHeader;
+
+    // If-Range: the client's copy must be the spooled one.
+    const char *condition = echttp_attribute_get ("If-Range");
+    if (condition) {
+        if (condition[0] == '"' || !strncmp (condition, "W/", 2)) {
+            // This requires a strong comparison: weak ETags never match.
+            if ((!strncmp (etag, "W/", 2)) || strcmp (condition, etag)) {
+                close (fd);
+                return 0;
+            }
+        } else {
+            char modified[128];
+            if ((!housecgi_spool_field (CgiSpoolHeader + start, length - start,
+                                        "Last-Modified",
+                                        modified, sizeof(modified))) ||
+                strcmp (condition, modified)) {
+                close (fd);
+                return 0;
+            }
+        }
+    }
+
+    int body = housecgi_execute_header (CgiSpoolHeader + start,
+                                        length - start);
+    if (body < 0) {
+        close (fd); // Not a valid response: run the CGI.
+        return 0;
+    }
+    body += start;
+    long long size = filestat.st_size - body;
+    long long first;
+    long long last;
+    int valid = housecgi_spool_range (range, size, &first, &last);
+    if (valid == 0) {
+        close (fd); // Ignore the range: run the CGI.
+        return 0;
+    }
+
+    static char contentrange[128];
+    echttp_attribute_set ("Accept-Ranges", "bytes");
+    echttp_attribute_set ("ETag", etag);
+    if (valid < 0) {
+        close (fd);
+        snprintf (contentrange, sizeof(contentrange), "bytes */%lld", size);
+        echttp_attribute_set ("Content-Range", contentrange);
+        echttp_error (416, "Range Not Satisfiable");
+        return "";
+    }
+    snprintf (contentrange, sizeof(contentrange),
+              "bytes %lld-%lld/%lld", first, last, size);
+    echttp_attribute_set ("Content-Range", contentrange);
+    echttp_error (206, "Partial Content");
+    lseek (fd, body + first, SEEK_SET);
+    echttp_transfer (fd, (int)(last - first + 1));
+    return "";
+}
+
+const char *housecgi_spool_lookup (int id, const char *method,
+                                   const char *uri) {
+
+    CgiSpoolPending = -1;
+    if ((id < 0) || (id >= CgiSpoolAppsCount)) return 0;
+    if (!housecgi_store_enabled()) return 0;
+    if (strcmp (method, "GET")) return 0;
+
+    // A response that depends on the client's credentials must not be
+    // replayed to another client.
+    if (echttp_attribute_get ("Cookie")) return 0;
+    if (echttp_attribute_get ("Authorization")) return 0;
+
+    // The query is part of the key through its signature, so that
+    // a long query does not make the key ambiguous.
+    static char query[0x4000];
+    query[0] = 0;
+    echttp_parameter_join (query, sizeof(query));
+    if (strlen (query) >= sizeof(query) - 1) return 0; // Truncated.
+    int keylength =
+        snprintf (CgiSpoolPendingKey, sizeof(CgiSpoolPendingKey),
+                  "%s GET %s %016llx", CgiSpoolApps[id].name, uri,
+                  (unsigned long long)echttp_hash_signature (query));
+    if (keylength >= sizeof(CgiSpoolPendingKey)) return 0; // Truncated.
+    snprintf (CgiSpoolPendingName, sizeof(CgiSpoolPendingName),
+              "spool-%016llx-%016llx",
+              (unsigned long long)CgiSpoolApps[id].signature,
+              (unsigned long long)echttp_hash_signature (CgiSpoolPendingKey));
+    CgiSpoolPending = id;
+
+    const char *range = echttp_attribute_get ("Range");
+    CgiSpoolRange = (range != 0);
+    if (!range) return 0;
+
+    const char *output = housecgi_spool_send (id, range);
+    if (output) {
+        CgiSpoolPending = -1;
+        CgiSpoolHits += 1;
+        return output;
+    }
+    CgiSpoolMisses += 1;
+    return 0;
+}
+
+// Return 1 if this CGI response can be spooled.
+//
+static int housecgi_spool_cacheable (const char *header, int length) {
+
+    char value[256];
+    if (housecgi_spool_field (header, length, "Status", value, sizeof(value))) {
+        if (atoi (value) != 200) return 0;
+    }
+    if (housecgi_spool_field (header, length, "Location", value, sizeof(value)))
+        return 0;
+    if (housecgi_spool_field (header, length,
+                              "Cache-Control", value, sizeof(value))) {
+        if (strcasestr (value, "no-store") || strcasestr (value, "private"))
+            return 0;
+    }
+    return 1;
+}
+
+const char *housecgi_spool_store (int id, int executor) {
+
+    if ((id < 0) || (id != CgiSpoolPending)) return 0;
+    CgiSpoolPending = -1;
+
+    if (housecgi_execute_timedout (executor)) return 0;
+    if (housecgi_execute_cancelled (executor)) return 0;
+
+    int fd = housecgi_store_create ();
+    if (fd < 0) return 0;
+
+    // The ETag will be known only after the CGI output has been
+    // decoded: reserve space for it.
+    char line[128];
+    int keylength = strlen (CgiSpoolPendingKey);
+    CgiSpoolPendingKey[keylength] = '\n';
+    int written = write (fd, CgiSpoolPendingKey, keylength + 1);
+    CgiSpoolPendingKey[keylength] = 0;
+    snprintf (line, sizeof(line), "%-100s\n", "");
+    written += write (fd, line, strlen(line));
+    if (written != keylength + 1 + strlen(line)) {
+        close (fd);
+        return 0;
+    }
+    if (housecgi_execute_save (executor, fd,
+                               housecgi_store_limit() - written) <= 0) {
+        close (fd);
+        return 0;
+    }
+
+    char header[4096];
+    int length = pread (fd, header, sizeof(header), written);
+    if ((length <= 0) || (!housecgi_spool_cacheable (header, length))) {
+        close (fd);
+        return 0;
+    }
+
+    // Use the CGI's own ETag if there is one.
+    char etag[96];
+    int own = (housecgi_spool_field (header, length, "ETag",
+                                     etag, sizeof(etag)) != 0);
+    if (!own) {
+        struct timeval now;
+        gettimeofday (&now, 0);
+        snprintf (etag, sizeof(etag), "\"%016llx-%llx\"",
+                  (unsigned long long)echttp_hash_signature (CgiSpoolPendingKey),
+                  (now.tv_sec * 1000000LL) + now.tv_usec);
+    }
+    snprintf (line, sizeof(line), "%s %lld", etag, (long long)time(0));
+    int linelength = strlen (line);
+    if ((strchr (etag, ' ')) || (linelength > 100) ||
+        (pwrite (fd, line, linelength, keylength + 1) != linelength)) {
+        close (fd);
+        return 0;
+    }
+
+    // Replace the previous response to the same request, if any.
+    housecgi_store_remove (CgiSpoolPendingName);
+    if (!housecgi_store_publish (fd, CgiSpoolPendingName)) return 0;
+    CgiSpoolStored += 1;
+
+    if (CgiSpoolRange) {
+        const char *output =
+            housecgi_spool_send (id, echttp_attribute_get ("Range"));
+        if (output) return output;
+    }
+    // The complete response is sent as usual, now with an ETag.
+    echttp_attribute_set ("Accept-Ranges", "bytes");
+    if (!own) {
+        static char generated[96];
+        snprintf (generated, sizeof(generated), "%s", etag);
+        echttp_attribute_set ("ETag", generated);
+    }
+    return 0;
+}
+
+int housecgi_spool_status (char *buffer, int size) {
+
+    if (CgiSpoolAppsCount <= 0) return 0;
+
+    int cursor = snprintf (buffer, size,
+                           "\"spool\":{\"hits\":%lld,\"misses\":%lld"
+                               ",\"stored\":%lld}",
+                           CgiSpoolHits, CgiSpoolMisses, CgiSpoolStored);
+    if (cursor >= size) return -1;
+    return cursor;
+}
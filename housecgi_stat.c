@@ -0,0 +1,217 @@
+/* HouseCGI - A simple home web service to support CGI applications.
+ *
+ * Copyright 2025, Pascal Martin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ * housecgi_stat.c - Publish the housecgi statistics in shared memory.
+ *
+ * This module creates the /dev/shm/housecgi-<instance> segment, where the
+ * workers and scheduler keep their counters. This segment can be read by
+ * other processes, e.g. housecgistat, without going through HTTP.
+ *
+ * HouseCgiStat *housecgi_stat_initialize (const char *instance);
+ *
+ *    Create the statistics segment and return its address. This must be
+ *    called before the workers are forked. If instance is null, the
+ *    segment is private to this process and its children (e.g. for
+ *    testing).
+ *
+ * void housecgi_stat_begin (void);
+ * void housecgi_stat_end (void);
+ *
+ *    Start and end an update of the statistics segment. An update must
+ *    be short, and must not call any other function that may lock.
+ *
+ * void housecgi_stat_lock (int32_t *lock);
+ * void housecgi_stat_unlock (int32_t *lock);
+ *
+ *    A spin lock for memory shared between workers. The lock holds the
+ *    process ID of its owner, so that a lock held by a process that died
+ *    (e.g. a worker killed in the middle of an update) can be taken over.
+ *
+ * void housecgi_stat_copy (char *d, const char *s, int size);
+ *
+ *    Copy a string to a text field of the segment, removing the characters
+ *    that would break JSON, since these fields are listed in the status.
+ *
+ * int  housecgi_stat_bucket (long long usec);
+ * long long housecgi_stat_bucket_floor (int bucket);
+ *
+ *    Return the latency histogram bucket for a response time, and the
+ *    lowest response time in a bucket. The buckets are log-linear: each
+ *    power of 2 (in microseconds) is split into 4 buckets, so the error
+ *    is less than 25%. The last bucket also holds all the response times
+ *    above one minute.
+ *
+ * double housecgi_stat_percentile (const uint32_t *latency,
+ *                                  long long count, double ratio);
+ *
+ *    Return the response time (in microseconds) at the specified rank
+ *    of a latency histogram holding count values, interpolated within
+ *    its bucket.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "echttp_libc.h"
+
+#include "housecgi_stat.h"
+
+static HouseCgiStat *CgiStat = 0;
+
+static HouseCgiStat *housecgi_stat_open (const char *instance) {
+
+    char name[64];
+    snprintf (name, sizeof(name), "/housecgi-%s", instance);
+
+    int fd = shm_open (name, O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+    if (fd < 0) return 0;
+    if (ftruncate (fd, sizeof(HouseCgiStat))) {
+        close (fd);
+        return 0;
+    }
+    HouseCgiStat *stat = mmap (0, sizeof(HouseCgiStat), PROT_READ|PROT_WRITE,
+                               MAP_SHARED, fd, 0);
+    close (fd);
+    if (stat == MAP_FAILED) return 0;
+    return stat;
+}
+
+HouseCgiStat *housecgi_stat_initialize (const char *instance) {
+
+    if (CgiStat) return CgiStat;
+
+    if (instance) {
+        CgiStat = housecgi_stat_open (instance);
+        if (!CgiStat)
+            fprintf (stderr, "Cannot create /dev/shm/housecgi-%s\n", instance);
+    }
+    if (!CgiStat) {
+        CgiStat = mmap (0, sizeof(HouseCgiStat), PROT_READ|PROT_WRITE,
+                        MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+        if (CgiStat == MAP_FAILED) {
+            fprintf (stderr, "Cannot allocate shared memory\n");
+            exit (1);
+        }
+    }
+    memset (CgiStat, 0, sizeof(HouseCgiStat));
+    CgiStat->version = HOUSECGI_STAT_VERSION;
+    CgiStat->size = sizeof(HouseCgiStat);
+    if (instance)
+        strtcpy (CgiStat->instance, instance, sizeof(CgiStat->instance));
+    CgiStat->pid = getpid();
+    CgiStat->started = time(0);
+
+    // Set the magic last: the segment is now valid.
+    __atomic_store_n (&(CgiStat->magic), HOUSECGI_STAT_MAGIC, __ATOMIC_RELEASE);
+    return CgiStat;
+}
+
+void housecgi_stat_lock (int32_t *lock) {
+
+    int32_t self = (int32_t)getpid();
+    int spins = 0;
+    for (;;) {
+        int32_t holder = 0;
+        if (__atomic_compare_exchange_n (lock, &holder, self, 0,
+                                         __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return;
+        // Check once in a while that the holder is still alive.
+        if ((++spins % 1000) == 0) {
+            if ((kill (holder, 0) < 0) && (errno == ESRCH)) {
+                if (__atomic_compare_exchange_n (lock, &holder, self, 0,
+                                                 __ATOMIC_ACQUIRE,
+                                                 __ATOMIC_RELAXED))
+                    return;
+            }
+        }
+        sched_yield();
+    }
+}
+
+void housecgi_stat_unlock (int32_t *lock) {
+    __atomic_store_n (lock, 0, __ATOMIC_RELEASE);
+}
+
+void housecgi_stat_begin (void) {
+    housecgi_stat_lock (&(CgiStat->lock));
+    // An update that was interrupted, because its process died, left
+    // the sequence odd.
+    if (CgiStat->sequence & 1)
+        __atomic_add_fetch (&(CgiStat->sequence), 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch (&(CgiStat->sequence), 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+}
+
+void housecgi_stat_end (void) {
+    __atomic_add_fetch (&(CgiStat->sequence), 1, __ATOMIC_RELEASE);
+    housecgi_stat_unlock (&(CgiStat->lock));
+}
+
+void housecgi_stat_copy (char *d, const char *s, int size) {
+    char *end = d + size - 1;
+    while (*s && (d < end)) {
+        if ((*s >= ' ') && (*s != '"') && (*s != '\\')) *(d++) = *s;
+        s += 1;
+    }
+    *d = 0;
+}
+
+int housecgi_stat_bucket (long long usec) {
+
+    if (usec < 4) return (usec > 0) ? (int)usec : 0;
+
+    int exponent = 63 - __builtin_clzll ((unsigned long long)usec);
+    int bucket = 4 * (exponent - 1) + (int)((usec >> (exponent - 2)) & 3);
+    if (bucket >= HOUSECGI_LATENCY_BUCKETS)
+        bucket = HOUSECGI_LATENCY_BUCKETS - 1;
+    return bucket;
+}
+
+long long housecgi_stat_bucket_floor (int bucket) {
+
+    if (bucket < 4) return bucket;
+    return (4LL + (bucket % 4)) << ((bucket / 4) - 1);
+}
+
+double housecgi_stat_percentile (const uint32_t *latency,
+                                 long long count, double ratio) {
+
+    long long rank = (long long)(count * ratio);
+    if (rank >= count) rank = count - 1;
+
+    int i;
+    for (i = 0; i < HOUSECGI_LATENCY_BUCKETS; ++i) {
+        if (rank < latency[i]) break;
+        rank -= latency[i];
+    }
+    if (i >= HOUSECGI_LATENCY_BUCKETS) i = HOUSECGI_LATENCY_BUCKETS - 1;
+
+    double low = housecgi_stat_bucket_floor (i);
+    double high = housecgi_stat_bucket_floor (i + 1);
+    if (latency[i] > 0) low += (high - low) * rank / latency[i];
+    return low;
+}
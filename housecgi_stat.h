@@ -0,0 +1,133 @@
+/* HouseCGI - A simple home web service to support CGI applications.
+ *
+ * Copyright 2025, Pascal Martin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ * housecgi_stat.h - Publish the housecgi statistics in shared memory.
+ *
+ * This defines the layout of the /dev/shm/housecgi-<instance> segment.
+ * The version must be incremented whenever this layout changes.
+ *
+ * The segment is protected by a sequence lock: the sequence number is odd
+ * while an update is in progress. A reader copies the segment and retries
+ * if the sequence was odd, or changed during the copy.
+ */
+
+#include <stdint.h>
+
+#define HOUSECGI_STAT_MAGIC   0x49474348 // "HCGI"
+#define HOUSECGI_STAT_VERSION 5
+
+#define HOUSECGI_WORKERS_MAX 64
+#define HOUSECGI_APPS_MAX   256
+#define HOUSECGI_EXPENSIVE_MAX 32
+#define HOUSECGI_LATENCY_BUCKETS 100
+
+#define HOUSECGI_WORKER_IDLE    0
+#define HOUSECGI_WORKER_QUEUED  1 // Handling a request, no CGI child yet.
+#define HOUSECGI_WORKER_RUNNING 2 // Waiting for a CGI child.
+
+typedef struct {
+    int32_t pid;
+    int32_t app;       // -1 when idle.
+    int64_t since;
+    int64_t requests;
+    int32_t state;
+    int32_t child;     // The process ID of the CGI child, if running.
+    int64_t started;   // Start of the current request (msec).
+    int64_t bytesin;   // Size of the request body.
+    int64_t bytesout;  // CGI output received so far.
+    int32_t kill;      // Cancel the CGI child (request from another worker).
+    char    uri[160];
+} HouseCgiStatWorker;
+
+typedef struct {
+    char    name[64];
+    int64_t signature;
+    int64_t requests;
+    int64_t bytes;     // Total size of the CGI output.
+    int32_t max;       // Size of the largest CGI output.
+    int32_t running;
+    int32_t limit;     // Current concurrency limit.
+    int64_t rejected;  // Requests rejected by the scheduler.
+    int64_t cpuuser;   // Total user CPU time of the CGI children (usec).
+    int64_t cpusystem; // Total system CPU time of the CGI children (usec).
+    int64_t inblock;   // Total block input operations.
+    int64_t oublock;   // Total block output operations.
+    int32_t rss;       // Largest resident memory of a CGI child (KB).
+    int32_t failed;    // CGI children that exited with an error code.
+    int32_t killed;    // CGI children killed by a signal.
+    int32_t cancelled; // CGI children terminated because the client left.
+    int64_t errors;    // Responses with a 5xx status.
+    int64_t probed;    // Time of the last synthetic probe.
+    int32_t probe;     // Response time of the last probe (usec).
+    int32_t baseline;  // Average response time of the probes (usec).
+    int32_t probestatus;
+    int32_t files;     // Files kept in the page cache.
+    int64_t locked;    // Bytes locked in memory.
+    int64_t updated;   // Last time this application's state changed.
+    int32_t draining;  // Reject new requests.
+    uint32_t latency[HOUSECGI_LATENCY_BUCKETS]; // See housecgi_stat_bucket().
+} HouseCgiStatApp;
+
+// The most expensive URIs are kept in a min-heap, ordered by CPU time:
+// the first entry is the least expensive one, replaced first.
+//
+typedef struct {
+    char    uri[160];
+    int32_t app;
+    int32_t count;     // Executions of this URI.
+    int64_t cpu;       // Highest CPU time, user and system (usec).
+    int32_t rss;       // Highest resident memory (KB).
+    int32_t status;    // Last exit status, as returned by wait4().
+    int64_t timestamp; // Last execution.
+} HouseCgiStatUri;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;     // Size of this structure.
+    uint32_t sequence; // Odd while an update is in progress.
+    int32_t  lock;     // Serialize the updates between workers.
+    char     instance[28];
+    int32_t  pid;      // The primary worker.
+    int64_t  started;
+    int32_t  workers;
+    int32_t  apps;
+    int32_t  running;  // CGI children running, all applications.
+    int64_t  rejected; // CGI requests rejected, all applications.
+    int32_t  max;      // Limit of CGI children running (0: no limit).
+    int32_t  expensive;
+    HouseCgiStatWorker worker[HOUSECGI_WORKERS_MAX];
+    HouseCgiStatApp    app[HOUSECGI_APPS_MAX];
+    HouseCgiStatUri    top[HOUSECGI_EXPENSIVE_MAX];
+} HouseCgiStat;
+
+HouseCgiStat *housecgi_stat_initialize (const char *instance);
+
+void housecgi_stat_begin (void);
+void housecgi_stat_end (void);
+
+void housecgi_stat_lock (int32_t *lock);
+void housecgi_stat_unlock (int32_t *lock);
+
+void housecgi_stat_copy (char *d, const char *s, int size);
+
+int  housecgi_stat_bucket (long long usec);
+long long housecgi_stat_bucket_floor (int bucket);
+double housecgi_stat_percentile (const uint32_t *latency,
+                                 long long count, double ratio);
@@ -0,0 +1,284 @@
+/* HouseCGI - A simple home web service to support CGI applications.
+ *
+ * Copyright 2025, Pascal Martin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ * housecgi_store.c - Keep CGI responses on local disk.
+ *
+ * This module manages a directory where large CGI responses are kept,
+ * so that they can be sent again later using sendfile(). Each entry is
+ * a file, identified by its name. The directory is shared by all the
+ * workers: an entry is written to an anonymous file first, and then
+ * linked in the directory once complete, so that no worker ever sees
+ * a partial entry.
+ *
+ * The total size of the directory is limited by a quota: when exceeded,
+ * the least recently used entries are removed. The time of last use is
+ * the modification time of the file.
+ *
+ * The store is enabled using the -cgi-store=PATH option. The quota is
+ * set using the -cgi-store-quota=N option, in megabytes (default 1024).
+ *
+ * void housecgi_store_initialize (int argc, const char **argv);
+ *
+ *    Initialize this module.
+ *
+ * int housecgi_store_enabled (void);
+ *
+ *    Return 1 if the store was enabled, 0 otherwise.
+ *
+ * int housecgi_store_limit (void);
+ *
+ *    Return the size of the largest entry accepted in the store. This is
+ *    half of the quota, but no more than what echttp can send (an int).
+ *
+ * int housecgi_store_open (const char *name);
+ *
+ *    Open the named entry for reading, and mark it as recently used.
+ *    Return the file descriptor, or -1 if there is no such entry.
+ *
+ * int housecgi_store_create (void);
+ *
+ *    Return the file descriptor of a new, anonymous, entry.
+ *
+ * int housecgi_store_publish (int fd, const char *name);
+ *
+ *    Make the entry visible under the specified name, and enforce
+ *    the quota. The file descriptor is closed. Return 1 on success,
+ *    0 on failure, e.g. if another worker published the same entry first.
+ *
+ * void housecgi_store_remove (const char *prefix);
+ *
+ *    Remove all the entries which name starts with the prefix.
+ *
+ * int housecgi_store_status (char *buffer, int size);
+ *
+ *    Return the store statistics in JSON format.
+ *    Return -1 if the buffer is too small.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "echttp.h"
+
+#include "housecgi_json.h"
+#include "housecgi_store.h"
+
+static const char *CgiStorePath = 0;
+static int CgiStoreDirectory = -1;
+static long long CgiStoreQuota = 1024LL * 1024 * 1024;
+
+static long long CgiStoreUsed = 0;
+static int CgiStoreEntries = 0;
+static long long CgiStoreStored = 0;
+static long long CgiStoreEvicted = 0;
+static long long CgiStoreRemoved = 0;
+
+typedef struct {
+    char   name[128];
+    off_t  size;
+    time_t used;
+} CgiStoreEntry;
+
+static int housecgi_store_oldest (const void *a, const void *b) {
+    time_t ta = ((const CgiStoreEntry *)a)->used;
+    time_t tb = ((const CgiStoreEntry *)b)->used;
+    return (ta < tb) ? -1 : (ta > tb) ? 1 : 0;
+}
+
+// Scan the directory to compute its total size, and remove the least
+// recently used entries if the quota is exceeded.
+//
+static void housecgi_store_enforce (void) {
+
+    // The directory stream takes ownership of its file descriptor.
+    int fd = dup (CgiStoreDirectory);
+    if (fd < 0) return;
+    DIR *dir = fdopendir (fd);
+    if (!dir) {
+        close (fd);
+        return;
+    }
+    rewinddir (dir);
+
+    CgiStoreEntry *list = 0;
+    int count = 0;
+    int size = 0;
+    long long used = 0;
+
+    struct dirent *ent;
+    while ((ent = readdir (dir))) {
+        if (ent->d_name[0] == '.') continue;
+        struct stat filestat;
+        if (fstatat (CgiStoreDirectory, ent->d_name, &filestat, 0)) continue;
+        if (!S_ISREG(filestat.st_mode)) continue;
+        if (strlen (ent->d_name) >= sizeof(list->name)) continue;
+        if (count >= size) {
+            size += 128;
+            list = realloc (list, size * sizeof(CgiStoreEntry));
+        }
+        strcpy (list[count].name, ent->d_name);
+        list[count].size = filestat.st_size;
+        list[count].used = filestat.st_mtime;
+        used += filestat.st_size;
+        count += 1;
+    }
+    closedir (dir);
+
+    if (used > CgiStoreQuota) {
+        qsort (list, count, sizeof(CgiStoreEntry), housecgi_store_oldest);
+        int i;
+        int evicted = 0;
+        for (i = 0; (i < count) && (used > CgiStoreQuota); ++i) {
+            if (unlinkat (CgiStoreDirectory, list[i].name, 0)) continue;
+            used -= list[i].size;
+            evicted += 1;
+        }
+        count -= evicted;
+        CgiStoreEvicted += evicted;
+    }
+    CgiStoreUsed = used;
+    CgiStoreEntries = count;
+    if (list) free (list);
+}
+
+void housecgi_store_initialize (int argc, const char **argv) {
+
+    int i;
+    const char *value;
+    for (i = 1; i < argc; ++i) {
+        if (echttp_option_match ("-cgi-store=", argv[i], &value)) {
+            CgiStorePath = value;
+        } else if (echttp_option_match ("-cgi-store-quota=", argv[i], &value)) {
+            long long quota = atoll (value);
+            if (quota > 0) CgiStoreQuota = quota * 1024 * 1024;
+        }
+    }
+    if (!CgiStorePath) return;
+
+    mkdir (CgiStorePath, 0700);
+    CgiStoreDirectory =
+        open (CgiStorePath, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if (CgiStoreDirectory < 0) {
+        fprintf (stderr, "Cannot open %s, no CGI store\n", CgiStorePath);
+        CgiStorePath = 0;
+        return;
+    }
+    housecgi_store_enforce ();
+}
+
+int housecgi_store_enabled (void) {
+    return (CgiStoreDirectory >= 0);
+}
+
+int housecgi_store_limit (void) {
+    // A single entry may not take more than half of the quota.
+    long long limit = CgiStoreQuota / 2;
+    if (limit > 0x7fffffff) limit = 0x7fffffff;
+    return (int)limit;
+}
+
+int housecgi_store_open (const char *name) {
+
+    if (CgiStoreDirectory < 0) return -1;
+    int fd = openat (CgiStoreDirectory, name, O_RDONLY|O_CLOEXEC);
+    if (fd < 0) return -1;
+    futimens (fd, 0); // Recently used.
+    return fd;
+}
+
+int housecgi_store_create (void) {
+
+    if (CgiStoreDirectory < 0) return -1;
+    return openat (CgiStoreDirectory, ".", O_TMPFILE|O_RDWR|O_CLOEXEC, 0600);
+}
+
+int housecgi_store_publish (int fd, const char *name) {
+
+    if (CgiStoreDirectory < 0) {
+        close (fd);
+        return 0;
+    }
+    struct stat filestat;
+    if (fstat (fd, &filestat) || (filestat.st_size > housecgi_store_limit())) {
+        close (fd);
+        return 0;
+    }
+    // Linking an O_TMPFILE file through /proc does not require
+    // any special privilege, unlike AT_EMPTY_PATH.
+    char path[64];
+    snprintf (path, sizeof(path), "/proc/self/fd/%d", fd);
+    int linked = linkat (AT_FDCWD, path,
+                         CgiStoreDirectory, name, AT_SYMLINK_FOLLOW);
+    close (fd);
+    if (linked) return 0; // Most likely published by another worker.
+
+    CgiStoreStored += 1;
+    housecgi_store_enforce ();
+    return 1;
+}
+
+void housecgi_store_remove (const char *prefix) {
+
+    if (CgiStoreDirectory < 0) return;
+
+    // The directory stream takes ownership of its file descriptor.
+    int fd = dup (CgiStoreDirectory);
+    if (fd < 0) return;
+    DIR *dir = fdopendir (fd);
+    if (!dir) {
+        close (fd);
+        return;
+    }
+    rewinddir (dir);
+    int length = strlen (prefix);
+    struct dirent *ent;
+    while ((ent = readdir (dir))) {
+        if (ent->d_name[0] == '.') continue;
+        if (strncmp (ent->d_name, prefix, length)) continue;
+        if (unlinkat (CgiStoreDirectory, ent->d_name, 0) == 0)
+            CgiStoreRemoved += 1;
+    }
+    closedir (dir);
+    housecgi_store_enforce ();
+}
+
+int housecgi_store_status (char *buffer, int size) {
+
+    if (!CgiStorePath) return 0;
+
+    char path[1024];
+    int cursor = snprintf (buffer, size,
+                           "\"store\":{\"path\":\"%s\",\"quota\":%lld"
+                               ",\"used\":%lld,\"entries\":%d"
+                               ",\"stored\":%lld,\"evicted\":%lld"
+                               ",\"removed\":%lld}",
+                           housecgi_json_escape (path, sizeof(path), CgiStorePath),
+                           CgiStoreQuota, CgiStoreUsed,
+                           CgiStoreEntries, CgiStoreStored,
+                           CgiStoreEvicted, CgiStoreRemoved);
+    if (cursor >= size) return -1;
+    return cursor;
+}
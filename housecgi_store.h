@@ -0,0 +1,32 @@
+/* HouseCGI - A simple home web service to support CGI applications.
+ *
+ * Copyright 2025, Pascal Martin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ * housecgi_store.h - Keep CGI responses on local disk.
+ */
+
+void housecgi_store_initialize (int argc, const char **argv);
+int  housecgi_store_enabled (void);
+int  housecgi_store_limit (void);
+
+int  housecgi_store_open (const char *name);
+int  housecgi_store_create (void);
+int  housecgi_store_publish (int fd, const char *name);
+void housecgi_store_remove (const char *prefix);
+
+int  housecgi_store_status (char *buffer, int size);
@@ -0,0 +1,209 @@
+/* HouseCGI - A simple home web service to support CGI applications.
+ *
+ * Copyright 2025, Pascal Martin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ * housecgi_trace.c - Record the timing of each phase of a CGI request.
+ *
+ * This module keeps the most recent CGI requests in a fixed size ring
+ * buffer, with a monotonic timestamp for each phase of the request.
+ * The content of the ring is exported in the Chrome trace event format,
+ * which can be loaded as is in chrome://tracing or in Perfetto.
+ *
+ * void housecgi_trace_initialize (const char *instance,
+ *                                 int argc, const char **argv);
+ *
+ *    Initialize this module and declare the /<instance>/trace URI.
+ *
+ * void housecgi_trace_start (const char *app,
+ *                            const char *method, const char *uri);
+ *
+ *    Start a new trace record. This is the "route matched" phase.
+ *
+ * void housecgi_trace_mark (int phase);
+ *
+ *    Record the time of the specified phase for the current request.
+ *    Only the first occurrence of each phase is kept.
+ *
+ * void housecgi_trace_pid (int pid);
+ *
+ *    Record the process ID of the CGI child for the current request.
+ *
+ * NOTE
+ *
+ *    CGI requests are executed synchronously, one at a time, so there
+ *    is only one current request: the phase functions do not need to
+ *    be told which request they apply to. The ring is never locked: a
+ *    new record simply overwrites the oldest one.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "echttp.h"
+
+#include "housecgi_trace.h"
+
+#define TRACE_DEPTH 256 // Must be a power of 2.
+
+typedef struct {
+    long long sequence;
+    int  pid;
+    char app[32];
+    char method[8];
+    char uri[128];
+    long long phases[HOUSECGI_TRACE_PHASES]; // Nanoseconds, 0: not reached.
+} CgiTraceRecord;
+
+static CgiTraceRecord CgiTraceRing[TRACE_DEPTH];
+static long long CgiTraceSequence = 0;
+static CgiTraceRecord *CgiTraceCurrent = 0;
+
+static const char *CgiTracePhaseName[HOUSECGI_TRACE_PHASES] = {
+    "route", "fork", "stdin", "first byte", "run", "header", "queue"
+};
+
+static long long housecgi_trace_now (void) {
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return (now.tv_sec * 1000000000LL) + now.tv_nsec;
+}
+
+// Copy a string while removing the characters that would break JSON.
+//
+static void housecgi_trace_copy (char *d, const char *s, int size) {
+    char *end = d + size - 1;
+    while (*s && (d < end)) {
+        if ((*s >= ' ') && (*s != '"') && (*s != '\\')) *(d++) = *s;
+        s += 1;
+    }
+    *d = 0;
+}
+
+void housecgi_trace_start (const char *app,
+                           const char *method, const char *uri) {
+
+    CgiTraceRecord *record = CgiTraceRing + (CgiTraceSequence & (TRACE_DEPTH-1));
+
+    memset (record->phases, 0, sizeof(record->phases));
+    record->pid = 0;
+    housecgi_trace_copy (record->app, app, sizeof(record->app));
+    housecgi_trace_copy (record->method, method, sizeof(record->method));
+    housecgi_trace_copy (record->uri, uri, sizeof(record->uri));
+    record->phases[HOUSECGI_TRACE_ROUTE] = housecgi_trace_now();
+    record->sequence = ++CgiTraceSequence;
+    CgiTraceCurrent = record;
+}
+
+void housecgi_trace_mark (int phase) {
+    if (!CgiTraceCurrent) return;
+    if ((phase <= HOUSECGI_TRACE_ROUTE) || (phase >= HOUSECGI_TRACE_PHASES))
+        return;
+    if (CgiTraceCurrent->phases[phase]) return; // Keep the first occurrence.
+    CgiTraceCurrent->phases[phase] = housecgi_trace_now();
+}
+
+void housecgi_trace_pid (int pid) {
+    if (CgiTraceCurrent) CgiTraceCurrent->pid = pid;
+}
+
+static int housecgi_trace_event (char *buffer, int size, int pid,
+                                 const CgiTraceRecord *record,
+                                 const char *name,
+                                 long long start, long long end) {
+    return snprintf (buffer, size,
+                     ",{\"name\":\"%s\",\"cat\":\"cgi\",\"ph\":\"X\""
+                         ",\"ts\":%lld.%03lld,\"dur\":%lld.%03lld"
+                         ",\"pid\":%d,\"tid\":%lld}",
+                     name, start / 1000, start % 1000,
+                     (end - start) / 1000, (end - start) % 1000,
+                     pid, record->sequence);
+}
+
+static const char *housecgi_trace_export (const char *method, const char *uri,
+                                          const char *data, int length) {
+
+    static char buffer[TRACE_DEPTH * 1536];
+    int size = sizeof(buffer) - 8; // Keep room for the JSON closure.
+    int pid = getpid();
+
+    int cursor = snprintf (buffer, size,
+                           "{\"displayTimeUnit\":\"ms\",\"traceEvents\":["
+                               "{\"name\":\"process_name\",\"ph\":\"M\""
+                               ",\"pid\":%d,\"args\":{\"name\":\"housecgi\"}}",
+                           pid);
+
+    long long oldest = CgiTraceSequence - TRACE_DEPTH + 1;
+    if (oldest < 1) oldest = 1;
+
+    long long s;
+    for (s = oldest; s <= CgiTraceSequence; ++s) {
+        const CgiTraceRecord *record = CgiTraceRing + ((s-1) & (TRACE_DEPTH-1));
+        if (record->sequence != s) continue; // Overwritten meanwhile.
+        int mark = cursor;
+
+        long long start = record->phases[HOUSECGI_TRACE_ROUTE];
+        long long end = start;
+        int i;
+        for (i = HOUSECGI_TRACE_PHASES - 1; i > 0; --i) {
+            if (record->phases[i] > end) end = record->phases[i];
+        }
+        cursor += snprintf (buffer+cursor, size-cursor,
+                            ",{\"name\":\"thread_name\",\"ph\":\"M\""
+                                ",\"pid\":%d,\"tid\":%lld"
+                                ",\"args\":{\"name\":\"%s #%lld\"}}",
+                            pid, record->sequence, record->app, s);
+        if (cursor >= size) { cursor = mark; break; }
+
+        cursor += snprintf (buffer+cursor, size-cursor,
+                            ",{\"name\":\"%s %s\",\"cat\":\"cgi\",\"ph\":\"X\""
+                                ",\"ts\":%lld.%03lld,\"dur\":%lld.%03lld"
+                                ",\"pid\":%d,\"tid\":%lld"
+                                ",\"args\":{\"app\":\"%s\",\"child\":%d}}",
+                            record->method, record->uri,
+                            start / 1000, start % 1000,
+                            (end - start) / 1000, (end - start) % 1000,
+                            pid, record->sequence, record->app, record->pid);
+        if (cursor >= size) { cursor = mark; break; }
+
+        // Each phase is shown as the time spent since the previous phase.
+        long long previous = start;
+        for (i = 1; i < HOUSECGI_TRACE_PHASES; ++i) {
+            if (!record->phases[i]) continue;
+            cursor += housecgi_trace_event (buffer+cursor, size-cursor,
+                                            pid, record,
+                                            CgiTracePhaseName[i],
+                                            previous, record->phases[i]);
+            if (cursor >= size) break;
+            previous = record->phases[i];
+        }
+        if (cursor >= size) { cursor = mark; break; }
+    }
+    snprintf (buffer+cursor, sizeof(buffer)-cursor, "]}");
+    echttp_content_type_json ();
+    return buffer;
+}
+
+void housecgi_trace_initialize (const char *instance,
+                                int argc, const char **argv) {
+
+    static char uri[128];
+    snprintf (uri, sizeof(uri), "/%s/trace", instance);
+    echttp_route_uri (uri, housecgi_trace_export);
+}
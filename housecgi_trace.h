@@ -0,0 +1,38 @@
+/* HouseCGI - A simple home web service to support CGI applications.
+ *
+ * Copyright 2025, Pascal Martin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ * housecgi_trace.h - Record the timing of each phase of a CGI request.
+ */
+
+#define HOUSECGI_TRACE_ROUTE     0
+#define HOUSECGI_TRACE_LAUNCH    1
+#define HOUSECGI_TRACE_STDIN     2
+#define HOUSECGI_TRACE_FIRSTBYTE 3
+#define HOUSECGI_TRACE_EXIT      4
+#define HOUSECGI_TRACE_HEADER    5
+#define HOUSECGI_TRACE_QUEUED    6
+#define HOUSECGI_TRACE_PHASES    7
+
+void housecgi_trace_initialize (const char *instance,
+                                int argc, const char **argv);
+
+void housecgi_trace_start (const char *app,
+                           const char *method, const char *uri);
+void housecgi_trace_mark (int phase);
+void housecgi_trace_pid (int pid);
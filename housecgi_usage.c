@@ -0,0 +1,298 @@
+/* HouseCGI - A simple home web service to support CGI applications.
+ *
+ * Copyright 2025, Pascal Martin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ * housecgi_usage.c - Account for the resources used by each CGI request.
+ *
+ * This module accumulates the resources used by the CGI children, as
+ * reported by wait4(), for each application: CPU time, largest resident
+ * memory, block I/O, exit status and cancellations. It also keeps the most expensive
+ * URIs executed recently (over the last hour), ordered by CPU time.
+ * All this is kept in the statistics segment, shared by all workers.
+ *
+ * A CGI request that uses more CPU time than -cgi-cpu-event=N milliseconds
+ * (default 5000), or more memory than -cgi-rss-event=N megabytes (default
+ * 0, disabled) is logged as an event. At most one event is logged per
+ * application per minute.
+ *
+ * void housecgi_usage_initialize (int argc, const char **argv);
+ *
+ *    Initialize this module.
+ *
+ * void housecgi_usage_record (int app, const char *name, const char *uri,
+ *                             const struct rusage *usage, int status,
+ *                             int cancelled);
+ *
+ *    Account for the resources used by a CGI request. A cancelled request
+ *    is not counted as killed, even if it was terminated by a signal.
+ *
+ * int  housecgi_usage_status (char *buffer, int size);
+ *
+ *    Return the list of the most expensive URIs in JSON format.
+ *    Return -1 if the buffer is too small.
+ *
+ * int  housecgi_usage_app_status (int app, char *buffer, int size);
+ *
+ *    Return the resources used by one application, as JSON fields
+ *    meant to be inserted in the application's object. The text starts
+ *    with a comma.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "echttp.h"
+#include "echttp_libc.h"
+#include "houselog.h"
+
+#include "housecgi_json.h"
+#include "housecgi_stat.h"
+#include "housecgi_usage.h"
+
+#define USAGE_WINDOW 3600 // How long an expensive URI is remembered.
+
+static HouseCgiStat *CgiStat = 0;
+
+static int CgiUsageCpuEvent = 5000; // Milliseconds.
+static int CgiUsageRssEvent = 0;    // Megabytes, 0 means disabled.
+
+static time_t CgiUsageLastEvent[HOUSECGI_APPS_MAX];
+
+void housecgi_usage_initialize (int argc, const char **argv) {
+
+    int i;
+    const char *value;
+    for (i = 1; i < argc; ++i) {
+        if (echttp_option_match ("-cgi-cpu-event=", argv[i], &value)) {
+            CgiUsageCpuEvent = atoi (value);
+        } else if (echttp_option_match ("-cgi-rss-event=", argv[i], &value)) {
+            CgiUsageRssEvent = atoi (value);
+        }
+    }
+    CgiStat = housecgi_stat_initialize (0); // Normally already done.
+}
+
+static void housecgi_usage_swap (int a, int b) {
+    HouseCgiStatUri swap = CgiStat->top[a];
+    CgiStat->top[a] = CgiStat->top[b];
+    CgiStat->top[b] = swap;
+}
+
+static void housecgi_usage_up (int i) {
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (CgiStat->top[parent].cpu <= CgiStat->top[i].cpu) break;
+        housecgi_usage_swap (i, parent);
+        i = parent;
+    }
+}
+
+static void housecgi_usage_down (int i) {
+    int count = CgiStat->expensive;
+    for (;;) {
+        int smallest = i;
+        int child = 2 * i + 1;
+        if ((child < count) &&
+            (CgiStat->top[child].cpu < CgiStat->top[smallest].cpu))
+            smallest = child;
+        child += 1;
+        if ((child < count) &&
+            (CgiStat->top[child].cpu < CgiStat->top[smallest].cpu))
+            smallest = child;
+        if (smallest == i) break;
+        housecgi_usage_swap (i, smallest);
+        i = smallest;
+    }
+}
+
+// Update the list of the most expensive URIs. This is called with
+// the statistics segment locked.
+//
+static void housecgi_usage_rank (int app, const char *uri,
+                                 long long cpu, int rss, int status,
+                                 time_t now) {
+    int i;
+    int found = -1;
+    for (i = 0; i < CgiStat->expensive; ++i) {
+        HouseCgiStatUri *entry = CgiStat->top + i;
+        if ((entry->timestamp < now - USAGE_WINDOW) && (entry->cpu > 0)) {
+            entry->cpu = 0; // Obsolete: make it the first to be replaced.
+            housecgi_usage_up (i);
+        }
+    }
+    for (i = 0; i < CgiStat->expensive; ++i) {
+        HouseCgiStatUri *entry = CgiStat->top + i;
+        if ((entry->app == app) && (!strcmp (entry->uri, uri))) {
+            found = i;
+            break;
+        }
+    }
+
+    HouseCgiStatUri *entry;
+    if (found >= 0) {
+        entry = CgiStat->top + found;
+        entry->count += 1;
+        entry->timestamp = now;
+        entry->status = status;
+        if (rss > entry->rss) entry->rss = rss;
+        if (cpu > entry->cpu) {
+            entry->cpu = cpu;
+            housecgi_usage_down (found);
+        }
+        return;
+    }
+
+    if (CgiStat->expensive < HOUSECGI_EXPENSIVE_MAX) {
+        i = CgiStat->expensive++;
+    } else if (CgiStat->top[0].cpu < cpu) {
+        i = 0; // Replace the least expensive.
+    } else {
+        return; // Not expensive enough.
+    }
+    entry = CgiStat->top + i;
+    housecgi_stat_copy (entry->uri, uri, sizeof(entry->uri));
+    entry->app = app;
+    entry->count = 1;
+    entry->cpu = cpu;
+    entry->rss = rss;
+    entry->status = status;
+    entry->timestamp = now;
+    if (i > 0) housecgi_usage_up (i);
+    else housecgi_usage_down (0);
+}
+
+static long long housecgi_usage_usec (const struct timeval *t) {
+    return (t->tv_sec * 1000000LL) + t->tv_usec;
+}
+
+void housecgi_usage_record (int app, const char *name, const char *uri,
+                            const struct rusage *usage, int status,
+                            int cancelled) {
+
+    if ((app < 0) || (app >= HOUSECGI_APPS_MAX) || (!usage)) return;
+
+    long long user = housecgi_usage_usec (&(usage->ru_utime));
+    long long system = housecgi_usage_usec (&(usage->ru_stime));
+    int rss = (int)(usage->ru_maxrss);
+    time_t now = time(0);
+
+    // The URI is compared with, and listed as, its copy in the segment.
+    char text[sizeof(CgiStat->top[0].uri)];
+    housecgi_stat_copy (text, uri, sizeof(text));
+
+    housecgi_stat_begin ();
+    HouseCgiStatApp *shared = CgiStat->app + app;
+    shared->cpuuser += user;
+    shared->cpusystem += system;
+    shared->inblock += usage->ru_inblock;
+    shared->oublock += usage->ru_oublock;
+    if (rss > shared->rss) shared->rss = rss;
+    if (cancelled) shared->cancelled += 1;
+    else if (WIFSIGNALED(status)) shared->killed += 1;
+    else if (WIFEXITED(status) && WEXITSTATUS(status)) shared->failed += 1;
+    housecgi_usage_rank (app, text, user + system, rss, status, now);
+    housecgi_stat_end ();
+
+    if (CgiUsageLastEvent[app] + 60 > now) return;
+
+    long long cpu = (user + system) / 1000;
+    if ((CgiUsageCpuEvent > 0) && (cpu >= CgiUsageCpuEvent)) {
+        houselog_event ("CGI", name, "EXPENSIVE",
+                        "%s USED %lld MS CPU", uri, cpu);
+        CgiUsageLastEvent[app] = now;
+    } else if ((CgiUsageRssEvent > 0) && (rss >= CgiUsageRssEvent * 1024)) {
+        houselog_event ("CGI", name, "EXPENSIVE",
+                        "%s USED %d MB RSS", uri, rss / 1024);
+        CgiUsageLastEvent[app] = now;
+    }
+}
+
+static int housecgi_usage_costlier (const void *a, const void *b) {
+    long long ca = ((const HouseCgiStatUri *)a)->cpu;
+    long long cb = ((const HouseCgiStatUri *)b)->cpu;
+    return (ca > cb) ? -1 : (ca < cb) ? 1 : 0;
+}
+
+static int housecgi_usage_exit (int status) {
+    if (WIFSIGNALED(status)) return -WTERMSIG(status);
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    return 0;
+}
+
+int housecgi_usage_status (char *buffer, int size) {
+
+    HouseCgiStatUri top[HOUSECGI_EXPENSIVE_MAX];
+
+    housecgi_stat_begin ();
+    int count = CgiStat->expensive;
+    memcpy (top, CgiStat->top, count * sizeof(HouseCgiStatUri));
+    housecgi_stat_end ();
+
+    qsort (top, count, sizeof(HouseCgiStatUri), housecgi_usage_costlier);
+
+    const char *sep = "";
+    int cursor = snprintf (buffer, size, "\"expensive\":[");
+    if (cursor >= size) return -1;
+
+    time_t now = time(0);
+    int i;
+    for (i = 0; i < count; ++i) {
+        if (top[i].timestamp < now - USAGE_WINDOW) continue;
+        if ((top[i].app < 0) || (top[i].app >= CgiStat->apps)) continue;
+        char name[256];
+        cursor += snprintf (buffer+cursor, size-cursor,
+                            "%s{\"service\":\"%s\",\"uri\":\"%s\""
+                                ",\"cpu\":%lld,\"rss\":%d,\"count\":%d"
+                                ",\"exit\":%d,\"timestamp\":%lld}",
+                            sep, housecgi_json_escape (name, sizeof(name),
+                                                       CgiStat->app[top[i].app].name),
+                            top[i].uri,
+                            (long long)(top[i].cpu / 1000), top[i].rss,
+                            top[i].count, housecgi_usage_exit (top[i].status),
+                            (long long)top[i].timestamp);
+        if (cursor >= size) return -1;
+        sep = ",";
+    }
+    cursor += snprintf (buffer+cursor, size-cursor, "]");
+    if (cursor >= size) return -1;
+    return cursor;
+}
+
+int housecgi_usage_app_status (int app, char *buffer, int size) {
+
+    if ((app < 0) || (app >= HOUSECGI_APPS_MAX)) return 0;
+
+    const HouseCgiStatApp *shared = CgiStat->app + app;
+    int cursor = snprintf (buffer, size,
+                           ",\"usage\":{\"user\":%lld,\"system\":%lld"
+                               ",\"rss\":%d,\"inblock\":%lld,\"oublock\":%lld"
+                               ",\"failed\":%d,\"killed\":%d"
+                               ",\"cancelled\":%d}",
+                           (long long)(shared->cpuuser / 1000),
+                           (long long)(shared->cpusystem / 1000),
+                           shared->rss,
+                           (long long)shared->inblock,
+                           (long long)shared->oublock,
+                           shared->failed, shared->killed, shared->cancelled);
+    if (cursor >= size) return 0;
+    return cursor;
+}
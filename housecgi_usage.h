@@ -0,0 +1,32 @@
+/* HouseCGI - A simple home web service to support CGI applications.
+ *
+ * Copyright 2025, Pascal Martin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ * housecgi_usage.h - Account for the resources used by each CGI request.
+ */
+
+struct rusage;
+
+void housecgi_usage_initialize (int argc, const char **argv);
+
+void housecgi_usage_record (int app, const char *name, const char *uri,
+                            const struct rusage *usage, int status,
+                            int cancelled);
+
+int  housecgi_usage_status (char *buffer, int size);
+int  housecgi_usage_app_status (int app, char *buffer, int size);
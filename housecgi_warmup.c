@@ -0,0 +1,638 @@
+/* HouseCGI - A simple home web service to support CGI applications.
+ *
+ * Copyright 2025, Pascal Martin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ * housecgi_warmup.c - Keep the CGI applications ready to run.
+ *
+ * This module avoids the cold start of a CGI application, for example
+ * the first request after an installation or after a quiet night:
+ *
+ * - The files needed to run each CGI application (the executable, its
+ *   interpreter if this is a script, and their shared libraries, as listed
+ *   by the system's dynamic loader) are read ahead into the page cache when
+ *   the application is discovered, and again every -cgi-warmup=N seconds
+ *   (default 600, 0 disables this). With the "mlock" application option,
+ *   these files are also locked in memory. This requires the CAP_IPC_LOCK
+ *   capability, or a large enough RLIMIT_MEMLOCK.
+ *
+ * - The identity of each executable (inode, size and modification time) is
+ *   checked on each scan of the cgi-bin directories. An executable that
+ *   was replaced is logged as UPGRADED, and its files are read again.
+ *
+ * - With the "probe[=PATH]" application option, a synthetic GET request
+ *   for /<name>/cgi[PATH] is sent to housecgi every -cgi-probe=N seconds
+ *   (default 300) if the application did not receive any other request
+ *   during that period. The response time of the last probe, and the
+ *   average of the recent probes (the baseline) are reported in the
+ *   status. The baseline restarts when the application is upgraded.
+ *   The probes are not counted in the application's statistics, and do
+ *   not influence the scheduler or the breaker. A probe is recognized by
+ *   a random token, generated when housecgi starts, that it carries in
+ *   a request header. Only a request from the loopback interface can be
+ *   a probe.
+ *
+ * Only the primary worker does this, since the page cache is shared.
+ *
+ * void housecgi_warmup_initialize (int argc, const char **argv);
+ *
+ *    Initialize this module. This must be called before the workers
+ *    are forked, since they all share the same probe token.
+ *
+ * void housecgi_warmup_declare (int app, const char *name, const char *path,
+ *                               const char *uri, const struct stat *filestat);
+ *
+ *    Declare a new CGI executable, and read its files ahead.
+ *
+ * void housecgi_warmup_check (int app, const struct stat *filestat);
+ *
+ *    Detect if the executable of this application was replaced.
+ *
+ * void housecgi_warmup_forget (int app);
+ *
+ *    The application was removed.
+ *
+ * void housecgi_warmup_background (time_t now);
+ *
+ *    Refresh the page cache and run the probes when it is time.
+ *
+ * int  housecgi_warmup_probing (void);
+ *
+ *    Return 1 if the current echttp request is a probe, 0 otherwise.
+ *
+ * int  housecgi_warmup_app_status (int app, char *buffer, int size);
+ *
+ *    Return the warm-up state of one application, as JSON fields
+ *    meant to be inserted in the application's object. The text starts
+ *    with a comma.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <link.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "echttp.h"
+#include "houselog.h"
+
+#include "housecgi_warmup.h"
+#include "housecgi_option.h"
+#include "housecgi_stat.h"
+#include "housecgi_worker.h"
+
+#define WARMUP_FILES_MAX 32
+
+#define WARMUP_PROBE_AGENT "housecgi-probe"
+#define WARMUP_PROBE_HEADER "X-HouseCGI-Probe"
+
+typedef struct {
+    char  *path;
+    void  *map;   // Only when locked in memory.
+    size_t size;
+} CgiWarmupFile;
+
+typedef struct {
+    char *name;
+    char *path;
+    char *probe;  // The URI to probe, 0 if none.
+    int   lock;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    CgiWarmupFile files[WARMUP_FILES_MAX];
+    int   count;
+    int64_t requests; // Requests at the time of the last probe.
+} CgiWarmupApp;
+
+static CgiWarmupApp CgiWarmup[HOUSECGI_APPS_MAX];
+
+static HouseCgiStat *CgiStat = 0;
+
+static int CgiWarmupPeriod = 600;
+static int CgiWarmupProbePeriod = 300;
+
+static time_t CgiWarmupRefreshed = 0;
+static time_t CgiWarmupProbed = 0;
+static pid_t  CgiWarmupProber = 0;
+static char   CgiWarmupToken[40]; // Empty if no probe can be recognized.
+
+static char CgiWarmupLoader[256];
+
+// Find the dynamic loader used by housecgi itself: this is the system's
+// dynamic loader, which can list the shared libraries of an executable
+// without running it.
+//
+static void housecgi_warmup_loader (void) {
+
+    CgiWarmupLoader[0] = 0;
+
+    int fd = open ("/proc/self/exe", O_RDONLY|O_CLOEXEC);
+    if (fd < 0) return;
+
+    ElfW(Ehdr) header;
+    if ((pread (fd, &header, sizeof(header), 0) != sizeof(header)) ||
+        memcmp (header.e_ident, ELFMAG, SELFMAG)) {
+        close (fd);
+        return;
+    }
+    int i;
+    for (i = 0; i < header.e_phnum; ++i) {
+        ElfW(Phdr) program;
+        off_t offset = header.e_phoff + (off_t)i * header.e_phentsize;
+        if (pread (fd, &program, sizeof(program), offset) != sizeof(program))
+            break;
+        if (program.p_type != PT_INTERP) continue;
+        if (program.p_filesz >= sizeof(CgiWarmupLoader)) break;
+        if (pread (fd, CgiWarmupLoader, program.p_filesz, program.p_offset)
+                != program.p_filesz) {
+            CgiWarmupLoader[0] = 0;
+            break;
+        }
+        CgiWarmupLoader[program.p_filesz] = 0;
+        break;
+    }
+    close (fd);
+}
+
+void housecgi_warmup_initialize (int argc, const char **argv) {
+
+    int i;
+    const char *value;
+    for (i = 1; i < argc; ++i) {
+        if (echttp_option_match ("-cgi-warmup=", argv[i], &value)) {
+            CgiWarmupPeriod = atoi (value);
+        } else if (echttp_option_match ("-cgi-probe=", argv[i], &value)) {
+            CgiWarmupProbePeriod = atoi (value);
+        }
+    }
+    CgiStat = housecgi_stat_initialize (0); // Normally already done.
+    housecgi_warmup_loader ();
+
+    unsigned char random[16];
+    CgiWarmupToken[0] = 0;
+    if (getrandom (random, sizeof(random), 0) == sizeof(random)) {
+        for (i = 0; i < sizeof(random); ++i)
+            sprintf (CgiWarmupToken + (2 * i), "%02x", random[i]);
+    }
+}
+
+static void housecgi_warmup_add (CgiWarmupApp *app, const char *path) {
+
+    if (path[0] != '/') return;
+    if (app->count >= WARMUP_FILES_MAX) return;
+
+    int i;
+    for (i = 0; i < app->count; ++i) {
+        if (!strcmp (app->files[i].path, path)) return; // Already listed.
+    }
+    app->files[app->count].path = strdup (path);
+    app->files[app->count].map = 0;
+    app->files[app->count].size = 0;
+    app->count += 1;
+}
+
+static void housecgi_warmup_clear (CgiWarmupApp *app) {
+    int i;
+    for (i = 0; i < app->count; ++i) {
+        CgiWarmupFile *file = app->files + i;
+        if (file->map) munmap (file->map, file->size); // Also unlocks.
+        free (file->path);
+    }
+    app->count = 0;
+}
+
+// List the shared libraries, as reported by the dynamic loader:
+//    libc.so.6 => /lib/x86_64-linux-gnu/libc.so.6 (0x...)
+//    /lib64/ld-linux-x86-64.so.2 (0x...)
+//
+static void housecgi_warmup_libraries (CgiWarmupApp *app, const char *path) {
+
+    if (!CgiWarmupLoader[0]) return;
+
+    int output[2];
+    if (pipe2 (output, O_CLOEXEC)) return;
+
+    pid_t child = fork ();
+    if (child == 0) {
+        dup2 (output[1], 1);
+        int null = open ("/dev/null", O_WRONLY);
+        if (null >= 0) dup2 (null, 2);
+        execl (CgiWarmupLoader, CgiWarmupLoader, "--list", path, (char *)0);
+        _exit (1);
+    }
+    close (output[1]);
+    if (child < 0) {
+        close (output[0]);
+        return;
+    }
+
+    FILE *list = fdopen (output[0], "r");
+    char line[1024];
+    while (list && fgets (line, sizeof(line), list)) {
+        char *library = strstr (line, "=> ");
+        if (library) library += 3;
+        else for (library = line; isspace(*library); ++library) ;
+        char *end = strchr (library, ' ');
+        if (end) *end = 0;
+        else if ((end = strchr (library, '\n'))) *end = 0;
+        housecgi_warmup_add (app, library);
+    }
+    if (list) fclose (list);
+    else close (output[0]);
+    waitpid (child, 0, 0);
+}
+
+// Build the list of the files needed to run this application.
+//
+static void housecgi_warmup_learn (CgiWarmupApp *app) {
+
+    housecgi_warmup_clear (app);
+    housecgi_warmup_add (app, app->path);
+
+    const char *target = app->path;
+    char interpreter[256];
+    int fd = open (app->path, O_RDONLY|O_CLOEXEC);
+    if (fd >= 0) {
+        int length = read (fd, interpreter, sizeof(interpreter) - 1);
+        close (fd);
+        if ((length > 2) && (interpreter[0] == '#') && (interpreter[1] == '!')) {
+            interpreter[length] = 0;
+            char *start = interpreter + 2;
+            while (*start == ' ' || *start == '\t') ++start;
+            char *end = start;
+            while (*end > ' ') ++end;
+            *end = 0;
+            housecgi_warmup_add (app, start);
+            target = start;
+        }
+    }
+    housecgi_warmup_libraries (app, target);
+}
+
+// Read the application's files into the page cache, and lock them
+// in memory if requested.
+//
+static void housecgi_warmup_prefetch (int index) {
+
+    CgiWarmupApp *app = CgiWarmup + index;
+    long long locked = 0;
+    int i;
+    for (i = 0; i < app->count; ++i) {
+        CgiWarmupFile *file = app->files + i;
+        if (file->map) {
+            locked += file->size;
+            continue; // Locked already.
+        }
+        int fd = open (file->path, O_RDONLY|O_CLOEXEC);
+        if (fd < 0) continue;
+        posix_fadvise (fd, 0, 0, POSIX_FADV_WILLNEED);
+        if (app->lock) {
+            struct stat filestat;
+            if ((fstat (fd, &filestat) == 0) && (filestat.st_size > 0)) {
+                void *map = mmap (0, filestat.st_size, PROT_READ,
+                                  MAP_SHARED, fd, 0);
+                if (map != MAP_FAILED) {
+                    if (mlock (map, filestat.st_size)) {
+                        munmap (map, filestat.st_size);
+                    } else {
+                        file->map = map;
+                        file->size = filestat.st_size;
+                        locked += file->size;
+                    }
+                }
+            }
+        }
+        close (fd);
+    }
+
+    housecgi_stat_begin ();
+    CgiStat->app[index].files = app->count;
+    CgiStat->app[index].locked = locked;
+    housecgi_stat_end ();
+}
+
+static void housecgi_warmup_identity (CgiWarmupApp *app,
+                                      const struct stat *filestat) {
+    app->dev = filestat->st_dev;
+    app->ino = filestat->st_ino;
+    app->size = filestat->st_size;
+    app->mtime = filestat->st_mtim;
+}
+
+void housecgi_warmup_declare (int app, const char *name, const char *path,
+                              const char *uri, const struct stat *filestat) {
+
+    if ((app < 0) || (app >= HOUSECGI_APPS_MAX)) return;
+    if (!housecgi_worker_primary()) return;
+
+    CgiWarmupApp *warmup = CgiWarmup + app;
+    if (warmup->name) housecgi_warmup_forget (app); // Reused slot.
+
+    warmup->name = strdup (name);
+    warmup->path = strdup (path);
+    warmup->lock = (housecgi_option_get (name, "mlock") != 0);
+    housecgi_warmup_identity (warmup, filestat);
+
+    const char *probe = housecgi_option_get (name, "probe");
+    if (probe) {
+        char buffer[512];
+        snprintf (buffer, sizeof(buffer), "%s%s", uri, probe);
+        warmup->probe = strdup (buffer);
+    }
+    warmup->requests = -1; // Probe on the next round.
+
+    if (CgiWarmupPeriod > 0) {
+        housecgi_warmup_learn (warmup);
+        housecgi_warmup_prefetch (app);
+    }
+}
+
+void housecgi_warmup_check (int app, const struct stat *filestat) {
+
+    if ((app < 0) || (app >= HOUSECGI_APPS_MAX)) return;
+
+    CgiWarmupApp *warmup = CgiWarmup + app;
+    if (!warmup->name) return;
+
+    if ((warmup->ino == filestat->st_ino) &&
+        (warmup->dev == filestat->st_dev) &&
+        (warmup->size == filestat->st_size) &&
+        (warmup->mtime.tv_sec == filestat->st_mtim.tv_sec) &&
+        (warmup->mtime.tv_nsec == filestat->st_mtim.tv_nsec)) return;
+
+    housecgi_warmup_identity (warmup, filestat);
+    houselog_event ("CGI", warmup->name, "UPGRADED",
+                    "EXECUTABLE %s", warmup->path);
+
+    housecgi_stat_begin ();
+    CgiStat->app[app].baseline = 0; // This is a new version.
+    housecgi_stat_end ();
+    warmup->requests = -1; // Probe the new version soon.
+
+    if (CgiWarmupPeriod > 0) {
+        housecgi_warmup_learn (warmup);
+        housecgi_warmup_prefetch (app);
+    }
+}
+
+void housecgi_warmup_forget (int app) {
+
+    if ((app < 0) || (app >= HOUSECGI_APPS_MAX)) return;
+
+    CgiWarmupApp *warmup = CgiWarmup + app;
+    if (!warmup->name) return;
+
+    housecgi_warmup_clear (warmup);
+    free (warmup->name);
+    warmup->name = 0;
+    free (warmup->path);
+    warmup->path = 0;
+    if (warmup->probe) {
+        free (warmup->probe);
+        warmup->probe = 0;
+    }
+    housecgi_stat_begin ();
+    CgiStat->app[app].files = 0;
+    CgiStat->app[app].locked = 0;
+    housecgi_stat_end ();
+}
+
+static long long housecgi_warmup_usec (void) {
+    struct timeval now;
+    gettimeofday (&now, 0);
+    return (now.tv_sec * 1000000LL) + now.tv_usec;
+}
+
+// Send one GET request to housecgi and wait for the complete response.
+// Return the HTTP status, or 0 on failure.
+//
+static int housecgi_warmup_get (int port, const char *uri) {
+
+    int s = socket (AF_INET, SOCK_STREAM|SOCK_CLOEXEC, 0);
+    if (s < 0) return 0;
+
+    struct timeval timeout = {30, 0};
+    setsockopt (s, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    struct sockaddr_in address;
+    memset (&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons (port);
+    address.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    if (connect (s, (struct sockaddr *)&address, sizeof(address))) {
+        close (s);
+        return 0;
+    }
+
+    char buffer[4096];
+    int length = snprintf (buffer, sizeof(buffer),
+                           "GET %s HTTP/1.1\r\nHost: localhost\r\n"
+                           "User-Agent: " WARMUP_PROBE_AGENT "\r\n"
+                           WARMUP_PROBE_HEADER ": %s\r\n"
+                           "Connection: close\r\n\r\n", uri, CgiWarmupToken);
+    if (write (s, buffer, length) != length) {
+        close (s);
+        return 0;
+    }
+
+    // Read the response until the end of the content, or until the
+    // connection is closed.
+    int status = 0;
+    long long expected = -1;
+    long long received = 0;
+    int header = 0;
+    for (;;) {
+        int count = read (s, buffer + header, sizeof(buffer) - header - 1);
+        if (count <= 0) break;
+        if (expected >= 0) {
+            received += count;
+            if (received >= expected) break;
+            continue;
+        }
+        header += count;
+        buffer[header] = 0;
+        char *end = strstr (buffer, "\r\n\r\n");
+        if (!end) {
+            if (header >= sizeof(buffer) - 1) break; // Header too long.
+            continue;
+        }
+        if (!strncmp (buffer, "HTTP/", 5)) {
+            char *code = strchr (buffer, ' ');
+            if (code) status = atoi (code + 1);
+        }
+        char *field = strcasestr (buffer, "\r\nContent-Length:");
+        expected = (field && (field < end)) ? atoll (field + 17) : 0;
+        received = header - (end + 4 - buffer);
+        header = 0;
+        if (received >= expected) break;
+    }
+    close (s);
+    return status;
+}
+
+// This runs in a child process, so that the primary worker remains
+// free to process the probe requests (there might be only one worker).
+//
+static void housecgi_warmup_probe (int *apps, int count) {
+
+    int port = echttp_port (4);
+    int i;
+
+    for (i = 3; i < 1024; ++i) close (i); // Do not hold any client socket.
+
+    for (i = 0; i < count; ++i) {
+        int app = apps[i];
+        long long start = housecgi_warmup_usec ();
+        int status = housecgi_warmup_get (port, CgiWarmup[app].probe);
+        long long latency = housecgi_warmup_usec () - start;
+
+        housecgi_stat_begin ();
+        HouseCgiStatApp *shared = CgiStat->app + app;
+        shared->probed = time(0);
+        shared->probe = (int)latency;
+        shared->probestatus = status;
+        if ((status > 0) && (status < 500)) {
+            if (shared->baseline > 0)
+                shared->baseline = ((7LL * shared->baseline) + latency) / 8;
+            else
+                shared->baseline = (int)latency;
+        }
+        housecgi_stat_end ();
+    }
+    _exit (0);
+}
+
+void housecgi_warmup_background (time_t now) {
+
+    if (!housecgi_worker_primary()) return;
+
+    int i;
+
+    if (CgiWarmupProber > 0) {
+        if (waitpid (CgiWarmupProber, 0, WNOHANG) == CgiWarmupProber)
+            CgiWarmupProber = 0;
+    }
+
+    if ((CgiWarmupPeriod > 0) && (now >= CgiWarmupRefreshed + CgiWarmupPeriod)) {
+        if (CgiWarmupRefreshed > 0) {
+            for (i = 0; i < HOUSECGI_APPS_MAX; ++i) {
+                if (CgiWarmup[i].name) housecgi_warmup_prefetch (i);
+            }
+        }
+        CgiWarmupRefreshed = now;
+    }
+
+    if ((CgiWarmupProbePeriod <= 0) || (CgiWarmupProber > 0)) return;
+    if (now < CgiWarmupProbed + CgiWarmupProbePeriod) {
+        // A new or upgraded application is probed without delay.
+        for (i = 0; i < HOUSECGI_APPS_MAX; ++i) {
+            if (CgiWarmup[i].probe && (CgiWarmup[i].requests < 0)) break;
+        }
+        if (i >= HOUSECGI_APPS_MAX) return;
+    }
+    CgiWarmupProbed = now;
+
+    // Probe only the applications that did not receive real requests
+    // since the last probe: the others are warm already.
+    int apps[HOUSECGI_APPS_MAX];
+    int count = 0;
+    for (i = 0; i < HOUSECGI_APPS_MAX; ++i) {
+        CgiWarmupApp *warmup = CgiWarmup + i;
+        if (!warmup->probe) continue;
+        // The probes are not counted as requests: whether this probe
+        // succeeds or not, only real requests change this counter.
+        int64_t requests = CgiStat->app[i].requests;
+        int idle = (warmup->requests < 0) || (requests == warmup->requests);
+        warmup->requests = requests;
+        if (idle) apps[count++] = i;
+    }
+    if (count <= 0) return;
+
+    pid_t child = fork ();
+    if (child == 0) housecgi_warmup_probe (apps, count);
+    if (child > 0) CgiWarmupProber = child;
+}
+
+// Return 1 if the current client is connected through the loopback
+// interface, i.e. it runs on this machine.
+//
+static int housecgi_warmup_local (void) {
+
+    int fd = echttp_client_socket ();
+    if (fd < 0) return 0;
+
+    struct sockaddr_storage peer;
+    socklen_t length = sizeof(peer);
+    if (getpeername (fd, (struct sockaddr *)&peer, &length)) return 0;
+
+    if (peer.ss_family == AF_INET) {
+        const struct sockaddr_in *ipv4 = (struct sockaddr_in *)&peer;
+        return (ntohl (ipv4->sin_addr.s_addr) >> 24) == 127;
+    }
+    if (peer.ss_family == AF_INET6) {
+        const struct in6_addr *ipv6 = &(((struct sockaddr_in6 *)&peer)->sin6_addr);
+        if (IN6_IS_ADDR_LOOPBACK(ipv6)) return 1;
+        return IN6_IS_ADDR_V4MAPPED(ipv6) && (ipv6->s6_addr[12] == 127);
+    }
+    return 0;
+}
+
+int housecgi_warmup_probing (void) {
+
+    if (!CgiWarmupToken[0]) return 0;
+
+    const char *token = echttp_attribute_get (WARMUP_PROBE_HEADER);
+    if ((!token) || strcmp (token, CgiWarmupToken)) return 0;
+    return housecgi_warmup_local ();
+}
+
+int housecgi_warmup_app_status (int app, char *buffer, int size) {
+
+    if ((app < 0) || (app >= HOUSECGI_APPS_MAX)) return 0;
+
+    const HouseCgiStatApp *shared = CgiStat->app + app;
+    int cursor = snprintf (buffer, size,
+                           ",\"warmup\":{\"files\":%d,\"locked\":%lld",
+                           shared->files, (long long)shared->locked);
+    if (cursor >= size) return 0;
+    if (shared->probed > 0) {
+        cursor += snprintf (buffer+cursor, size-cursor,
+                            ",\"probe\":{\"latency\":%d,\"baseline\":%d"
+                                ",\"status\":%d,\"timestamp\":%lld}",
+                            shared->probe / 1000, shared->baseline / 1000,
+                            shared->probestatus, (long long)shared->probed);
+        if (cursor >= size) return 0;
+    }
+    cursor += snprintf (buffer+cursor, size-cursor, "}");
+    if (cursor >= size) return 0;
+    return cursor;
+}
@@ -0,0 +1,35 @@
+/* HouseCGI - A simple home web service to support CGI applications.
+ *
+ * Copyright 2025, Pascal Martin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ * housecgi_warmup.h - Keep the CGI applications ready to run.
+ */
+
+struct stat;
+
+void housecgi_warmup_initialize (int argc, const char **argv);
+
+void housecgi_warmup_declare (int app, const char *name, const char *path,
+                              const char *uri, const struct stat *filestat);
+void housecgi_warmup_check (int app, const struct stat *filestat);
+void housecgi_warmup_forget (int app);
+
+void housecgi_warmup_background (time_t now);
+int  housecgi_warmup_probing (void);
+
+int  housecgi_warmup_app_status (int app, char *buffer, int size);
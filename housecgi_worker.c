@@ -0,0 +1,570 @@
+/* HouseCGI - A simple home web service to support CGI applications.
+ *
+ * Copyright 2025, Pascal Martin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ * housecgi_worker.c - Run multiple housecgi worker processes.
+ *
+ * CGI requests are executed synchronously, which means that one housecgi
+ * process handles only one CGI request at a time. This module forks
+ * additional housecgi processes ("workers") that all accept connections
+ * on the same listening socket, so that multiple CGI requests can be
+ * executed in parallel.
+ *
+ * Each worker discovers the CGI applications independently (they all
+ * scan the same cgi-bin directory), but only the primary worker (the
+ * original process) registers the routes with HousePortal.
+ *
+ * The workers share the statistics segment (see housecgi_stat.c), where
+ * each one publishes its state and the per application counters, so that
+ * any worker can report the state of all workers.
+ *
+ * A worker that dies is replaced. The replacement cannot be forked from
+ * the primary, which has accumulated its own state (HTTP clients, etc.):
+ * it is forked by a "spawner" process, a copy of the primary made before
+ * any other module was initialized, on request from the primary. If the
+ * same worker keeps dying, the restart is delayed longer each time, up
+ * to one minute.
+ *
+ * void housecgi_worker_initialize (int argc, const char **argv);
+ *
+ *    Initialize this module and fork the additional workers (option
+ *    -workers=N). This must be called after echttp_open(), so that the
+ *    listening socket is inherited by all workers, and before any other
+ *    module is initialized, so that each worker has its own context.
+ *
+ * int  housecgi_worker_primary (void);
+ * int  housecgi_worker_index (void);
+ *
+ *    Return 1 if this process is the primary worker, 0 otherwise.
+ *    Return the index of this worker, 0 for the primary.
+ *
+ * int  housecgi_worker_app (const char *name);
+ *
+ *    Return the index of the application's shared counters. The entry is
+ *    created if it does not exist yet. Return -1 if the table is full.
+ *
+ * void housecgi_worker_busy (int app, const char *uri);
+ * void housecgi_worker_idle (int app, int size);
+ *
+ *    Record that this worker is executing, or has completed, a request
+ *    for the specified application. This also accounts for the response
+ *    time and status of the request.
+ *
+ * void housecgi_worker_running (int pid, int bytesin);
+ * void housecgi_worker_progress (long long bytesout);
+ *
+ *    Record that the current request is now executed by a CGI child,
+ *    and how much output this child produced so far.
+ *
+ * int  housecgi_worker_kill (int pid);
+ * int  housecgi_worker_killed (void);
+ *
+ *    Request the worker that runs the specified CGI child to cancel it.
+ *    Return the application index, or -1 if no worker runs that child.
+ *    The worker checks if its own child must be cancelled by calling
+ *    housecgi_worker_killed().
+ *
+ * int  housecgi_worker_drain (const char *name, int drain);
+ * int  housecgi_worker_draining (int app);
+ *
+ *    Stop (or resume) accepting new requests for the specified application,
+ *    while the requests already accepted complete. Return the application
+ *    index, or -1 if not found.
+ *
+ * time_t housecgi_worker_updated (int app);
+ *
+ *    Return the last time the state of the application changed.
+ *
+ * long long housecgi_worker_requests (int app);
+ * int  housecgi_worker_max (int app);
+ *
+ *    Return the application counters, accumulated over all workers.
+ *
+ * void housecgi_worker_background (time_t now);
+ *
+ *    Detect the workers that died, and restart them.
+ *
+ * int  housecgi_worker_status (char *buffer, int size);
+ *
+ *    Return the state of all workers in JSON format.
+ *    Return -1 if the buffer is too small.
+ *
+ * int  housecgi_worker_children_status (char *buffer, int size);
+ *
+ *    Return the requests that are currently executing, in JSON format.
+ *    Return -1 if the buffer is too small.
+ *
+ * NOTE
+ *
+ *    The workers share the listening socket created by echttp, instead of
+ *    using SO_REUSEPORT: echttp does not offer a way to set this option
+ *    before the socket is bound. The listening socket, as reported by
+ *    echttp before the workers are forked, is made non blocking
+ *    so that a worker that loses the race to accept a new connection is
+ *    not stuck in accept().
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "echttp.h"
+#include "echttp_hash.h"
+#include "echttp_libc.h"
+#include "houselog.h"
+
+#include "housecgi_capture.h"
+#include "housecgi_json.h"
+#include "housecgi_schedule.h"
+#include "housecgi_stat.h"
+#include "housecgi_worker.h"
+
+static int Debug = 0;
+
+#define DEBUG if (Debug) printf
+
+static HouseCgiStat *CgiShared = 0;
+static int CgiWorkerIndex = 0;
+
+static struct timespec CgiWorkerStart; // Start of the current request.
+
+// The spawner, and the restart of each worker (primary only).
+static int    CgiWorkerSpawner = -1;
+static pid_t  CgiWorkerSpawnerPid = 0;
+static time_t CgiWorkerRestart[HOUSECGI_WORKERS_MAX]; // 0: not needed.
+static time_t CgiWorkerBorn[HOUSECGI_WORKERS_MAX];
+static int    CgiWorkerBackoff[HOUSECGI_WORKERS_MAX];
+
+#define WORKER_BACKOFF_MAX 60
+
+// The listening sockets opened by echttp (IPv4 and IPv6), as inherited
+// by all workers.
+static int CgiWorkerListen[2] = {-1, -1};
+
+static void housecgi_worker_unblock (void) {
+
+    CgiWorkerListen[0] = echttp_server_socket (4);
+    CgiWorkerListen[1] = echttp_server_socket (6);
+
+    int i;
+    for (i = 0; i < 2; ++i) {
+        int fd = CgiWorkerListen[i];
+        if (fd < 0) continue;
+        if ((i > 0) && (fd == CgiWorkerListen[0])) continue; // Dual stack.
+        fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+        DEBUG ("Listening socket %d shared by all workers.\n", fd);
+    }
+}
+
+// The spawner waits for requests from the primary, each one being the
+// index of a worker to restart. This returns only in a new worker.
+//
+static void housecgi_worker_spawner (int input) {
+
+    prctl (PR_SET_PDEATHSIG, SIGTERM); // Exit with the primary.
+    for (;;) {
+        struct pollfd wait = {input, POLLIN, 0};
+        int ready = poll (&wait, 1, 1000);
+        while (waitpid (-1, 0, WNOHANG) > 0) ; // Reap the dead workers.
+        if (ready <= 0) continue;
+
+        int index;
+        if (read (input, &index, sizeof(index)) != sizeof(index)) exit (0);
+        if ((index < 1) || (index >= HOUSECGI_WORKERS_MAX)) continue;
+        if (fork() == 0) {
+            close (input);
+            CgiWorkerIndex = index;
+            CgiShared->worker[index].app = -1;
+            CgiShared->worker[index].pid = getpid();
+            prctl (PR_SET_PDEATHSIG, SIGTERM); // Exit with the spawner.
+            return;
+        }
+    }
+}
+
+static void housecgi_worker_start_spawner (void) {
+
+    int channel[2];
+    if (socketpair (AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, channel)) return;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        close (channel[1]);
+        housecgi_worker_spawner (channel[0]);
+        return; // This is now a new worker.
+    }
+    close (channel[0]);
+    if (pid < 0) {
+        close (channel[1]);
+        return;
+    }
+    CgiWorkerSpawner = channel[1];
+    CgiWorkerSpawnerPid = pid;
+}
+
+void housecgi_worker_initialize (int argc, const char **argv) {
+
+    int workers = 1;
+
+    int i;
+    const char *value;
+    for (i = 1; i < argc; ++i) {
+        if (echttp_option_match ("-workers=", argv[i], &value)) {
+            workers = atoi (value);
+        } else if (echttp_option_present ("-d", argv[i])) {
+            Debug = 1;
+        }
+    }
+    if (workers < 1) workers = 1;
+    if (workers > HOUSECGI_WORKERS_MAX) workers = HOUSECGI_WORKERS_MAX;
+
+    CgiShared = housecgi_stat_initialize (0); // Normally already done.
+    CgiShared->workers = workers;
+    CgiShared->worker[0].pid = getpid();
+    CgiShared->worker[0].app = -1;
+
+    if (workers <= 1) return;
+
+    housecgi_worker_unblock ();
+
+    for (i = 1; i < workers; ++i) {
+        CgiShared->worker[i].app = -1;
+        pid_t pid = fork();
+        if (pid < 0) {
+            fprintf (stderr, "Cannot start worker %d\n", i);
+            CgiShared->workers = i;
+            break;
+        }
+        if (pid == 0) {
+            CgiWorkerIndex = i;
+            CgiShared->worker[i].pid = getpid();
+            prctl (PR_SET_PDEATHSIG, SIGTERM); // Exit with the primary.
+            break;
+        }
+        CgiShared->worker[i].pid = pid;
+    }
+    if (CgiWorkerIndex == 0) housecgi_worker_start_spawner ();
+    DEBUG ("Worker %d started as process %d.\n", CgiWorkerIndex, getpid());
+}
+
+int housecgi_worker_primary (void) {
+    return CgiWorkerIndex == 0;
+}
+
+int housecgi_worker_index (void) {
+    return CgiWorkerIndex;
+}
+
+int housecgi_worker_app (const char *name) {
+
+    long long signature = echttp_hash_signature (name);
+    int i;
+
+    housecgi_stat_begin ();
+    for (i = 0; i < CgiShared->apps; ++i) {
+        HouseCgiStatApp *app = CgiShared->app + i;
+        if (app->signature != signature) continue;
+        if (strcmp (app->name, name)) continue;
+        housecgi_stat_end ();
+        return i;
+    }
+    if (CgiShared->apps >= HOUSECGI_APPS_MAX) {
+        housecgi_stat_end ();
+        return -1;
+    }
+    i = CgiShared->apps;
+    strtcpy (CgiShared->app[i].name, name, sizeof(CgiShared->app[i].name));
+    CgiShared->app[i].signature = signature;
+    CgiShared->apps += 1;
+    housecgi_stat_end ();
+    return i;
+}
+
+static long long housecgi_worker_clock (void) {
+    struct timeval now;
+    gettimeofday (&now, 0);
+    return (now.tv_sec * 1000LL) + (now.tv_usec / 1000);
+}
+
+void housecgi_worker_busy (int app, const char *uri) {
+    HouseCgiStatWorker *slot = CgiShared->worker + CgiWorkerIndex;
+    clock_gettime (CLOCK_MONOTONIC, &CgiWorkerStart);
+    long long started = housecgi_worker_clock ();
+    housecgi_stat_begin ();
+    slot->since = time(0);
+    slot->app = app;
+    slot->state = HOUSECGI_WORKER_QUEUED;
+    slot->started = started;
+    slot->child = 0;
+    slot->bytesin = slot->bytesout = 0;
+    slot->kill = 0;
+    housecgi_stat_copy (slot->uri, uri, sizeof(slot->uri));
+    if ((app >= 0) && (app < CgiShared->apps))
+        CgiShared->app[app].updated = slot->since;
+    housecgi_stat_end ();
+}
+
+void housecgi_worker_running (int pid, int bytesin) {
+    HouseCgiStatWorker *slot = CgiShared->worker + CgiWorkerIndex;
+    housecgi_stat_begin ();
+    slot->state = HOUSECGI_WORKER_RUNNING;
+    slot->child = pid;
+    slot->bytesin = bytesin;
+    housecgi_stat_end ();
+}
+
+void housecgi_worker_progress (long long bytesout) {
+    // Only this worker writes this field, and the value is only informative:
+    // no need to lock.
+    HouseCgiStatWorker *slot = CgiShared->worker + CgiWorkerIndex;
+    __atomic_store_n (&(slot->bytesout), bytesout, __ATOMIC_RELAXED);
+}
+
+int housecgi_worker_kill (int pid) {
+
+    int app = -1;
+    int i;
+    housecgi_stat_begin ();
+    for (i = 0; i < CgiShared->workers; ++i) {
+        HouseCgiStatWorker *slot = CgiShared->worker + i;
+        if ((slot->state != HOUSECGI_WORKER_RUNNING) || (slot->child != pid))
+            continue;
+        slot->kill = 1;
+        app = slot->app;
+        break;
+    }
+    housecgi_stat_end ();
+    if ((app >= 0) && (app < CgiShared->apps))
+        houselog_event ("CGI", CgiShared->app[app].name, "KILLED",
+                        "PROCESS %d", pid);
+    return app;
+}
+
+int housecgi_worker_killed (void) {
+    HouseCgiStatWorker *slot = CgiShared->worker + CgiWorkerIndex;
+    return __atomic_load_n (&(slot->kill), __ATOMIC_RELAXED);
+}
+
+int housecgi_worker_drain (const char *name, int drain) {
+
+    long long signature = echttp_hash_signature (name);
+    int i;
+
+    housecgi_stat_begin ();
+    for (i = 0; i < CgiShared->apps; ++i) {
+        HouseCgiStatApp *app = CgiShared->app + i;
+        if (app->signature != signature) continue;
+        if (strcmp (app->name, name)) continue;
+        int changed = (app->draining != drain);
+        app->draining = drain;
+        app->updated = time(0);
+        housecgi_stat_end ();
+        if (changed)
+            houselog_event ("CGI", name, drain ? "DRAINING" : "RESUMED", "");
+        return i;
+    }
+    housecgi_stat_end ();
+    return -1;
+}
+
+int housecgi_worker_draining (int app) {
+    if ((app < 0) || (app >= CgiShared->apps)) return 0;
+    return CgiShared->app[app].draining;
+}
+
+time_t housecgi_worker_updated (int app) {
+    if ((app < 0) || (app >= CgiShared->apps)) return 0;
+    return (time_t)(CgiShared->app[app].updated);
+}
+
+void housecgi_worker_idle (int app, int size) {
+
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    long long latency = ((now.tv_sec - CgiWorkerStart.tv_sec) * 1000000LL)
+                        + ((now.tv_nsec - CgiWorkerStart.tv_nsec) / 1000);
+    int bucket = housecgi_stat_bucket (latency);
+    int status = housecgi_capture_result ();
+
+    HouseCgiStatWorker *slot = CgiShared->worker + CgiWorkerIndex;
+    housecgi_stat_begin ();
+    slot->since = time(0);
+    slot->app = -1;
+    slot->requests += 1;
+    slot->state = HOUSECGI_WORKER_IDLE;
+    slot->child = 0;
+    slot->kill = 0;
+
+    if ((app >= 0) && (app < CgiShared->apps)) {
+        HouseCgiStatApp *shared = CgiShared->app + app;
+        shared->updated = slot->since;
+        shared->requests += 1;
+        if (size > 0) shared->bytes += size;
+        if (size > shared->max) shared->max = size;
+        if (status >= 500) shared->errors += 1;
+        shared->latency[bucket] += 1;
+    }
+    housecgi_stat_end ();
+}
+
+long long housecgi_worker_requests (int app) {
+    if ((app < 0) || (app >= CgiShared->apps)) return 0;
+    return CgiShared->app[app].requests;
+}
+
+int housecgi_worker_max (int app) {
+    if ((app < 0) || (app >= CgiShared->apps)) return 0;
+    return CgiShared->app[app].max;
+}
+
+void housecgi_worker_background (time_t now) {
+
+    if (CgiWorkerIndex) return; // Only the primary monitors the workers.
+
+    if (CgiWorkerSpawnerPid > 0) {
+        if (waitpid (CgiWorkerSpawnerPid, 0, WNOHANG) == CgiWorkerSpawnerPid) {
+            houselog_event ("WORKER", "housecgi", "DIED",
+                            "PROCESS %d (SPAWNER)", CgiWorkerSpawnerPid);
+            close (CgiWorkerSpawner);
+            CgiWorkerSpawner = -1;
+            CgiWorkerSpawnerPid = 0;
+        }
+    }
+
+    int i;
+    for (i = 1; i < CgiShared->workers; ++i) {
+        HouseCgiStatWorker *slot = CgiShared->worker + i;
+        if (slot->pid <= 0) {
+            if ((!CgiWorkerRestart[i]) || (now < CgiWorkerRestart[i])) continue;
+            CgiWorkerRestart[i] = 0;
+            if (CgiWorkerSpawner < 0) continue;
+            if (send (CgiWorkerSpawner, &i, sizeof(i), MSG_NOSIGNAL) != sizeof(i))
+                continue;
+            CgiWorkerBorn[i] = now;
+            houselog_event ("WORKER", "housecgi", "RESTARTED", "WORKER %d", i);
+            continue;
+        }
+        // A restarted worker is a child of the spawner, not of the primary.
+        int status;
+        if ((waitpid (slot->pid, &status, WNOHANG) != slot->pid) &&
+            ((kill (slot->pid, 0) == 0) || (errno != ESRCH))) continue;
+
+        houselog_event ("WORKER", "housecgi", "DIED",
+                        "PROCESS %d (WORKER %d)", slot->pid, i);
+        housecgi_schedule_abandon (i);
+        housecgi_stat_begin ();
+        slot->pid = 0;
+        slot->app = -1;
+        slot->state = HOUSECGI_WORKER_IDLE;
+        housecgi_stat_end ();
+
+        // Wait longer before a restart if this worker died soon after
+        // the previous one.
+        if (now - CgiWorkerBorn[i] > WORKER_BACKOFF_MAX)
+            CgiWorkerBackoff[i] = 1;
+        else if (CgiWorkerBackoff[i] < WORKER_BACKOFF_MAX)
+            CgiWorkerBackoff[i] = CgiWorkerBackoff[i] ? 2 * CgiWorkerBackoff[i] : 1;
+        if (CgiWorkerBackoff[i] > WORKER_BACKOFF_MAX)
+            CgiWorkerBackoff[i] = WORKER_BACKOFF_MAX;
+        CgiWorkerRestart[i] = now + CgiWorkerBackoff[i];
+    }
+}
+
+int housecgi_worker_status (char *buffer, int size) {
+
+    const char *sep = "";
+    int cursor = snprintf (buffer, size, "\"workers\":[");
+    if (cursor >= size) return -1;
+
+    int i;
+    for (i = 0; i < CgiShared->workers; ++i) {
+        HouseCgiStatWorker *slot = CgiShared->worker + i;
+        if (slot->pid <= 0) continue;
+        int app = slot->app;
+        if ((app >= 0) && (app < CgiShared->apps)) {
+            char name[256];
+            cursor += snprintf (buffer+cursor, size-cursor,
+                                "%s{\"pid\":%d,\"requests\":%lld"
+                                    ",\"busy\":\"%s\",\"since\":%lld}",
+                                sep, slot->pid, (long long)slot->requests,
+                                housecgi_json_escape (name, sizeof(name),
+                                                      CgiShared->app[app].name),
+                                (long long)slot->since);
+        } else {
+            cursor += snprintf (buffer+cursor, size-cursor,
+                                "%s{\"pid\":%d,\"requests\":%lld"
+                                    ",\"since\":%lld}",
+                                sep, slot->pid, (long long)slot->requests,
+                                (long long)slot->since);
+        }
+        if (cursor >= size) return -1;
+        sep = ",";
+    }
+
+    cursor += snprintf (buffer+cursor, size-cursor, "]");
+    if (cursor >= size) return -1;
+    return cursor;
+}
+
+int housecgi_worker_children_status (char *buffer, int size) {
+
+    static const char *stateName[] = {"idle", "queued", "running"};
+    long long now = housecgi_worker_clock ();
+
+    const char *sep = "";
+    int cursor = snprintf (buffer, size, "\"children\":[");
+    if (cursor >= size) return -1;
+
+    int i;
+    for (i = 0; i < CgiShared->workers; ++i) {
+        HouseCgiStatWorker *slot = CgiShared->worker + i;
+        if (slot->pid <= 0) continue;
+        if ((slot->state != HOUSECGI_WORKER_QUEUED) &&
+            (slot->state != HOUSECGI_WORKER_RUNNING)) continue;
+        int app = slot->app;
+        if ((app < 0) || (app >= CgiShared->apps)) continue;
+        char name[256];
+        cursor += snprintf (buffer+cursor, size-cursor,
+                            "%s{\"worker\":%d,\"pid\":%d,\"app\":\"%s\""
+                                ",\"uri\":\"%s\",\"state\":\"%s\""
+                                ",\"elapsed\":%lld"
+                                ",\"in\":%lld,\"out\":%lld}",
+                            sep, i, slot->child,
+                            housecgi_json_escape (name, sizeof(name),
+                                                  CgiShared->app[app].name),
+                            slot->uri, stateName[slot->state],
+                            now - (long long)slot->started,
+                            (long long)slot->bytesin,
+                            (long long)slot->bytesout);
+        if (cursor >= size) return -1;
+        sep = ",";
+    }
+    cursor += snprintf (buffer+cursor, size-cursor, "]");
+    if (cursor >= size) return -1;
+    return cursor;
+}
@@ -0,0 +1,47 @@
+/* HouseCGI - A simple home web service to support CGI applications.
+ *
+ * Copyright 2025, Pascal Martin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ * housecgi_worker.h - Run multiple housecgi worker processes.
+ */
+
+void housecgi_worker_initialize (int argc, const char **argv);
+int  housecgi_worker_primary (void);
+int  housecgi_worker_index (void);
+
+int  housecgi_worker_app (const char *name);
+void housecgi_worker_busy (int app, const char *uri);
+void housecgi_worker_idle (int app, int size);
+
+void housecgi_worker_running (int pid, int bytesin);
+void housecgi_worker_progress (long long bytesout);
+
+int  housecgi_worker_kill (int pid);
+int  housecgi_worker_killed (void);
+
+int  housecgi_worker_drain (const char *name, int drain);
+int  housecgi_worker_draining (int app);
+
+time_t housecgi_worker_updated (int app);
+
+long long housecgi_worker_requests (int app);
+int  housecgi_worker_max (int app);
+
+void housecgi_worker_background (time_t now);
+int  housecgi_worker_status (char *buffer, int size);
+int  housecgi_worker_children_status (char *buffer, int size);
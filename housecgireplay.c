@@ -0,0 +1,401 @@
+/* HouseCGI - A simple home web service to support CGI applications.
+ *
+ * Copyright 2025, Pascal Martin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ * housecgireplay.c - Replay a housecgi capture against a test instance.
+ *
+ * This tool reads a capture file produced by housecgi (option
+ * -cgi-capture), sends each request to a housecgi instance and then
+ * compares the latency distribution, status and size of the responses
+ * with the ones that were captured.
+ *
+ * Usage: housecgireplay [-host=NAME] -port=N [-speed=N|max] [-clients=N]
+ *                       [-v] FILE
+ *
+ * -host=NAME   The host running the housecgi instance (default: localhost).
+ * -port=N      The housecgi instance's HTTP port (required: housecgi
+ *              normally uses a dynamic port, see HousePortal).
+ * -speed=N     Replay N times faster than captured (default: 1). With
+ *              "max", each request is sent as soon as the previous one
+ *              completed.
+ * -clients=N   The number of concurrent clients (default: 4). The
+ *              requests are distributed round robin among clients.
+ * -v           Print one line for each request.
+ *
+ * A request which body was not stored in the capture is skipped.
+ */
+
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+
+#include "housecgi_capture.h"
+
+typedef struct {
+    uint32_t index;
+    uint32_t latency;   // Microseconds, 0 if the request failed.
+    uint32_t size;
+    uint16_t status;
+    uint16_t skipped;
+} ReplayResult;
+
+static const char *ReplayHost = "localhost";
+static const char *ReplayPort = 0;
+static double ReplaySpeed = 1.0; // 0: as fast as possible.
+static int ReplayClients = 4;
+static int ReplayVerbose = 0;
+
+static const char *ReplayData = 0;
+static size_t ReplayDataSize = 0;
+
+static const HouseCgiCaptureRecord **ReplayRecords = 0;
+static int ReplayCount = 0;
+
+static long long replay_now (void) {
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return (now.tv_sec * 1000000LL) + (now.tv_nsec / 1000);
+}
+
+static int replay_load (const char *path) {
+
+    int fd = open (path, O_RDONLY);
+    if (fd < 0) {
+        fprintf (stderr, "Cannot open %s\n", path);
+        return 0;
+    }
+    struct stat filestat;
+    if (fstat (fd, &filestat) || (filestat.st_size <= 0)) {
+        fprintf (stderr, "Empty capture %s\n", path);
+        close (fd);
+        return 0;
+    }
+    ReplayDataSize = filestat.st_size;
+    ReplayData = mmap (0, ReplayDataSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (ReplayData == MAP_FAILED) {
+        fprintf (stderr, "Cannot map %s\n", path);
+        return 0;
+    }
+
+    int size = 0;
+    size_t cursor = 0;
+    while (cursor + sizeof(HouseCgiCaptureRecord) <= ReplayDataSize) {
+        const HouseCgiCaptureRecord *record =
+            (const HouseCgiCaptureRecord *)(ReplayData + cursor);
+        if ((record->magic != HOUSECGI_CAPTURE_MAGIC) ||
+            (record->size < sizeof(HouseCgiCaptureRecord)) ||
+            (cursor + record->size > ReplayDataSize)) {
+            fprintf (stderr, "Invalid record at offset %zd, stopping\n", cursor);
+            break;
+        }
+        if (ReplayCount >= size) {
+            size += 1024;
+            ReplayRecords = realloc (ReplayRecords, size * sizeof(*ReplayRecords));
+        }
+        ReplayRecords[ReplayCount++] = record;
+        cursor += record->size;
+    }
+    return ReplayCount;
+}
+
+// Return the next string of a record, and its length.
+//
+static const char *replay_string (const char **cursor, int *length) {
+    uint16_t encoded;
+    memcpy (&encoded, *cursor, sizeof(encoded));
+    const char *text = *cursor + sizeof(encoded);
+    *length = encoded;
+    *cursor = text + encoded;
+    return text;
+}
+
+static int replay_connect (void) {
+
+    struct addrinfo hints;
+    struct addrinfo *resolved;
+    memset (&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo (ReplayHost, ReplayPort, &hints, &resolved)) return -1;
+
+    int fd = -1;
+    struct addrinfo *cursor;
+    for (cursor = resolved; cursor; cursor = cursor->ai_next) {
+        fd = socket (cursor->ai_family, cursor->ai_socktype|SOCK_CLOEXEC, 0);
+        if (fd < 0) continue;
+        if (connect (fd, cursor->ai_addr, cursor->ai_addrlen) == 0) break;
+        close (fd);
+        fd = -1;
+    }
+    freeaddrinfo (resolved);
+    return fd;
+}
+
+static int replay_send (int fd, const char *data, int length) {
+    while (length > 0) {
+        int sent = write (fd, data, length);
+        if (sent <= 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += sent;
+        length -= sent;
+    }
+    return 0;
+}
+
+// Send one request and wait for the complete response, which is discarded.
+//
+static void replay_request (const HouseCgiCaptureRecord *record,
+                            ReplayResult *result) {
+
+    static char *header = 0;
+    static int headersize = 0;
+
+    int needed = record->size + 256;
+    if (needed > headersize) {
+        headersize = needed;
+        header = realloc (header, headersize);
+    }
+    const char *cursor = (const char *)(record + 1);
+    int methodlen, urilen, querylen;
+    const char *method = replay_string (&cursor, &methodlen);
+    const char *uri = replay_string (&cursor, &urilen);
+    const char *query = replay_string (&cursor, &querylen);
+
+    int length = snprintf (header, headersize, "%.*s %.*s%s%.*s HTTP/1.1\r\n"
+                                               "Host: %s\r\n",
+                           methodlen, method, urilen, uri,
+                           querylen ? "?" : "", querylen, query, ReplayHost);
+    int i;
+    for (i = 3; i + 1 < record->strings; i += 2) {
+        int namelen, valuelen;
+        const char *name = replay_string (&cursor, &namelen);
+        const char *value = replay_string (&cursor, &valuelen);
+        length += snprintf (header+length, headersize-length, "%.*s: %.*s\r\n",
+                            namelen, name, valuelen, value);
+    }
+    if (record->length > 0)
+        length += snprintf (header+length, headersize-length,
+                            "Content-Length: %u\r\n", record->length);
+    length += snprintf (header+length, headersize-length,
+                        "Connection: close\r\n\r\n");
+
+    long long start = replay_now();
+    int fd = replay_connect ();
+    if (fd < 0) return;
+    if (replay_send (fd, header, length) ||
+        replay_send (fd, cursor, record->stored)) {
+        close (fd);
+        return;
+    }
+
+    char buffer[0x10000];
+    int total = 0;
+    int body = -1;
+    for (;;) {
+        int received = read (fd, buffer + total, sizeof(buffer) - total - 1);
+        if (received < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (received == 0) break;
+        if (body >= 0) {
+            result->size += received; // Do not keep the body.
+            continue;
+        }
+        total += received;
+        buffer[total] = 0;
+        char *end = strstr (buffer, "\r\n\r\n");
+        if (end) {
+            body = (end - buffer) + 4;
+            result->size = total - body;
+            if (!strncmp (buffer, "HTTP/1.", 7))
+                result->status = atoi (buffer + 9);
+        } else if (total >= sizeof(buffer) - 1) {
+            break; // Header is too large?
+        }
+    }
+    close (fd);
+    if (body < 0) return;
+    result->latency = (uint32_t)(replay_now() - start);
+    if (result->latency == 0) result->latency = 1;
+}
+
+static void replay_client (int client, int output) {
+
+    long long start = replay_now();
+    int64_t origin = ReplayRecords[0]->timestamp;
+
+    int i;
+    for (i = client; i < ReplayCount; i += ReplayClients) {
+        const HouseCgiCaptureRecord *record = ReplayRecords[i];
+        ReplayResult result;
+        memset (&result, 0, sizeof(result));
+        result.index = i;
+
+        if (record->stored < record->length) {
+            result.skipped = 1;
+        } else {
+            if (ReplaySpeed > 0) {
+                long long due =
+                    start + (long long)((record->timestamp - origin) / ReplaySpeed);
+                long long delay = due - replay_now();
+                if (delay > 0) usleep (delay);
+            }
+            replay_request (record, &result);
+        }
+        write (output, &result, sizeof(result));
+    }
+}
+
+static int replay_compare (const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void replay_distribution (const char *title,
+                                 uint32_t *latency, int count) {
+    if (count <= 0) return;
+    qsort (latency, count, sizeof(uint32_t), replay_compare);
+    double sum = 0;
+    int i;
+    for (i = 0; i < count; ++i) sum += latency[i];
+    printf ("%-10s %10.2f %10.2f %10.2f %10.2f %10.2f\n", title,
+            sum / count / 1000.0,
+            latency[count / 2] / 1000.0,
+            latency[(count * 90) / 100] / 1000.0,
+            latency[(count * 99) / 100] / 1000.0,
+            latency[count - 1] / 1000.0);
+}
+
+int main (int argc, const char **argv) {
+
+    const char *path = 0;
+    int i;
+    for (i = 1; i < argc; ++i) {
+        if (!strncmp (argv[i], "-host=", 6)) {
+            ReplayHost = argv[i] + 6;
+        } else if (!strncmp (argv[i], "-port=", 6)) {
+            ReplayPort = argv[i] + 6;
+        } else if (!strncmp (argv[i], "-speed=", 7)) {
+            if (!strcmp (argv[i] + 7, "max")) ReplaySpeed = 0;
+            else ReplaySpeed = atof (argv[i] + 7);
+            if (ReplaySpeed < 0) ReplaySpeed = 0;
+        } else if (!strncmp (argv[i], "-clients=", 9)) {
+            ReplayClients = atoi (argv[i] + 9);
+            if (ReplayClients < 1) ReplayClients = 1;
+        } else if (!strcmp (argv[i], "-v")) {
+            ReplayVerbose = 1;
+        } else if (argv[i][0] == '-') {
+            fprintf (stderr, "Invalid option %s\n", argv[i]);
+            return 1;
+        } else {
+            path = argv[i];
+        }
+    }
+    if ((!path) || (!ReplayPort)) {
+        fprintf (stderr, "usage: housecgireplay [-host=NAME] -port=N "
+                         "[-speed=N|max] [-clients=N] [-v] FILE\n");
+        return 1;
+    }
+    if (!replay_load (path)) return 1;
+    if (ReplayClients > ReplayCount) ReplayClients = ReplayCount;
+
+    int channel[2];
+    if (pipe (channel)) return 1;
+
+    for (i = 0; i < ReplayClients; ++i) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            fprintf (stderr, "Cannot start client %d\n", i);
+            return 1;
+        }
+        if (pid == 0) {
+            close (channel[0]);
+            replay_client (i, channel[1]);
+            exit (0);
+        }
+    }
+    close (channel[1]);
+
+    uint32_t *captured = calloc (ReplayCount, sizeof(uint32_t));
+    uint32_t *replayed = calloc (ReplayCount, sizeof(uint32_t));
+    int completed = 0;
+    int skipped = 0;
+    int failed = 0;
+    int statusdiff = 0;
+    int sizediff = 0;
+
+    ReplayResult result;
+    while (read (channel[0], &result, sizeof(result)) == sizeof(result)) {
+        if (result.index >= ReplayCount) continue;
+        const HouseCgiCaptureRecord *record = ReplayRecords[result.index];
+        if (result.skipped) {
+            skipped += 1;
+            continue;
+        }
+        if (result.latency == 0) {
+            failed += 1;
+            continue;
+        }
+        if (result.status != record->status) statusdiff += 1;
+        else if ((record->status == 200) && (result.size != record->response))
+            sizediff += 1; // Error messages do not count.
+        captured[completed] = record->latency;
+        replayed[completed] = result.latency;
+        completed += 1;
+
+        if (ReplayVerbose) {
+            const char *cursor = (const char *)(record + 1);
+            int methodlen, urilen;
+            const char *method = replay_string (&cursor, &methodlen);
+            const char *uri = replay_string (&cursor, &urilen);
+            printf ("%.*s %.*s: status %d (%d), size %u (%u), "
+                    "latency %.2f ms (%.2f)\n",
+                    methodlen, method, urilen, uri,
+                    result.status, record->status,
+                    result.size, record->response,
+                    result.latency / 1000.0, record->latency / 1000.0);
+        }
+    }
+    while (wait(0) > 0) ;
+
+    printf ("%d requests, %d replayed, %d skipped (body not captured), "
+            "%d failed\n", ReplayCount, completed, skipped, failed);
+    printf ("%d status differences, %d size differences\n",
+            statusdiff, sizediff);
+    if (completed > 0) {
+        printf ("\nLatency (ms)     mean        p50        p90"
+                "        p99        max\n");
+        replay_distribution ("captured", captured, completed);
+        replay_distribution ("replayed", replayed, completed);
+    }
+    return ((failed > 0) || (statusdiff > 0)) ? 1 : 0;
+}
@@ -0,0 +1,244 @@
+/* HouseCGI - A simple home web service to support CGI applications.
+ *
+ * Copyright 2025, Pascal Martin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ * housecgistat.c - Show the live housecgi statistics.
+ *
+ * This tool reads the /dev/shm/housecgi-<instance> segment published
+ * by housecgi and shows the activity of each CGI application and of each
+ * worker, and the most expensive URIs, refreshed periodically, similar
+ * to top. It does not interact
+ * with the housecgi processes in any way.
+ *
+ * Usage: housecgistat [-instance=NAME] [-interval=N] [-once]
+ *
+ * -instance=NAME  The housecgi instance to show (default: cgi).
+ * -interval=N     The refresh period in seconds (default: 1).
+ * -once           Print the statistics once and exit.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "housecgi_stat.h"
+
+static const char *StatInstance = "cgi";
+static int StatInterval = 1;
+static int StatOnce = 0;
+
+static const HouseCgiStat *StatShared = 0;
+
+static HouseCgiStat StatCurrent;
+static HouseCgiStat StatPrevious;
+static int StatHasPrevious = 0;
+
+static int stat_open (void) {
+
+    char name[64];
+    snprintf (name, sizeof(name), "/housecgi-%s", StatInstance);
+    int fd = shm_open (name, O_RDONLY, 0);
+    if (fd < 0) {
+        fprintf (stderr, "No housecgi instance %s (/dev/shm%s)\n",
+                 StatInstance, name);
+        return 0;
+    }
+    struct stat filestat;
+    if (fstat (fd, &filestat) || (filestat.st_size < sizeof(HouseCgiStat))) {
+        fprintf (stderr, "Invalid or incompatible segment /dev/shm%s\n", name);
+        close (fd);
+        return 0;
+    }
+    StatShared = mmap (0, sizeof(HouseCgiStat), PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (StatShared == MAP_FAILED) {
+        fprintf (stderr, "Cannot map /dev/shm%s\n", name);
+        return 0;
+    }
+    if ((StatShared->magic != HOUSECGI_STAT_MAGIC) ||
+        (StatShared->version != HOUSECGI_STAT_VERSION) ||
+        (StatShared->size != sizeof(HouseCgiStat))) {
+        fprintf (stderr, "Incompatible segment /dev/shm%s (version %u)\n",
+                 name, StatShared->version);
+        return 0;
+    }
+    return 1;
+}
+
+// Take a consistent copy of the segment, using the sequence lock.
+//
+static void stat_read (HouseCgiStat *copy) {
+
+    for (;;) {
+        uint32_t before =
+            __atomic_load_n (&(StatShared->sequence), __ATOMIC_ACQUIRE);
+        if (before & 1) {
+            sched_yield ();
+            continue;
+        }
+        memcpy (copy, StatShared, sizeof(HouseCgiStat));
+        __atomic_thread_fence (__ATOMIC_ACQUIRE);
+        if (__atomic_load_n (&(StatShared->sequence), __ATOMIC_RELAXED) == before)
+            return;
+    }
+}
+
+static void stat_bytes (char *buffer, int size, double value) {
+    static const char *unit[] = {"", "K", "M", "G", "T"};
+    int i = 0;
+    while ((value >= 10000) && (i < 4)) {
+        value /= 1024;
+        i += 1;
+    }
+    snprintf (buffer, size, "%.0f%s", value, unit[i]);
+}
+
+static int stat_costlier (const void *a, const void *b) {
+    long long ca = ((const HouseCgiStatUri *)a)->cpu;
+    long long cb = ((const HouseCgiStatUri *)b)->cpu;
+    return (ca > cb) ? -1 : (ca < cb) ? 1 : 0;
+}
+
+static void stat_show (double elapsed) {
+
+    const HouseCgiStat *now = &StatCurrent;
+    const HouseCgiStat *before = StatHasPrevious ? &StatPrevious : 0;
+
+    time_t clock = time(0);
+    long long uptime = (long long)(clock - now->started);
+    int alive = (kill (now->pid, 0) == 0);
+
+    printf ("housecgi %s, pid %d%s, up %lldd %02lld:%02lld:%02lld, %s",
+            now->instance, now->pid, alive ? "" : " (not running)",
+            uptime / 86400, (uptime / 3600) % 24, (uptime / 60) % 60,
+            uptime % 60, ctime(&clock));
+    printf ("Workers: %d, CGI running: %d", now->workers, now->running);
+    if (now->max > 0) printf (" (max %d)", now->max);
+    printf (", rejected: %lld\n\n", (long long)now->rejected);
+
+    printf ("%-24s %8s %10s %7s %6s %5s %8s %8s %6s %8s\n",
+            "APPLICATION", "REQ/S", "REQUESTS", "RUNNING", "REJ/S",
+            "LIMIT", "BYTES/S", "MAX", "CPU%", "RSS");
+
+    int i;
+    for (i = 0; i < now->apps && i < HOUSECGI_APPS_MAX; ++i) {
+        const HouseCgiStatApp *app = now->app + i;
+        double rate = 0;
+        double rejected = 0;
+        double throughput = 0;
+        double cpu = 0;
+        if (before && (elapsed > 0) && (i < before->apps)) {
+            const HouseCgiStatApp *old = before->app + i;
+            rate = (app->requests - old->requests) / elapsed;
+            rejected = (app->rejected - old->rejected) / elapsed;
+            throughput = (app->bytes - old->bytes) / elapsed;
+            cpu = (app->cpuuser + app->cpusystem
+                       - old->cpuuser - old->cpusystem) / (elapsed * 10000);
+        }
+        char bytes[16];
+        char max[16];
+        char rss[16];
+        stat_bytes (bytes, sizeof(bytes), throughput);
+        stat_bytes (max, sizeof(max), app->max);
+        stat_bytes (rss, sizeof(rss), app->rss * 1024.0);
+        printf ("%-24.24s %8.1f %10lld %7d %6.1f %5d %8s %8s %6.1f %8s\n",
+                app->name, rate, (long long)app->requests,
+                app->running, rejected, app->limit, bytes, max, cpu, rss);
+    }
+
+    printf ("\n%-6s %8s %-24s %8s %10s\n",
+            "WORKER", "PID", "STATE", "SINCE", "REQUESTS");
+    for (i = 0; i < now->workers && i < HOUSECGI_WORKERS_MAX; ++i) {
+        const HouseCgiStatWorker *worker = now->worker + i;
+        const char *state = "idle";
+        if (worker->pid <= 0) state = "dead";
+        else if ((worker->app >= 0) && (worker->app < now->apps))
+            state = now->app[worker->app].name;
+        long long since = worker->since ? (long long)(clock - worker->since) : 0;
+        printf ("%-6d %8d %-24.24s %7llds %10lld\n",
+                i, worker->pid, state, since, (long long)worker->requests);
+    }
+
+    int count = now->expensive;
+    if (count > HOUSECGI_EXPENSIVE_MAX) count = HOUSECGI_EXPENSIVE_MAX;
+    if (count <= 0) return;
+
+    HouseCgiStatUri top[HOUSECGI_EXPENSIVE_MAX];
+    memcpy (top, now->top, count * sizeof(HouseCgiStatUri));
+    qsort (top, count, sizeof(HouseCgiStatUri), stat_costlier);
+
+    printf ("\n%-16s %10s %8s %6s %s\n", "APPLICATION", "CPU(ms)", "RSS",
+            "COUNT", "EXPENSIVE URI");
+    for (i = 0; i < count; ++i) {
+        if ((top[i].app < 0) || (top[i].app >= now->apps)) continue;
+        char rss[16];
+        stat_bytes (rss, sizeof(rss), top[i].rss * 1024.0);
+        printf ("%-16.16s %10lld %8s %6d %s\n",
+                now->app[top[i].app].name, (long long)(top[i].cpu / 1000),
+                rss, top[i].count, top[i].uri);
+    }
+}
+
+static long long stat_now (void) {
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return (now.tv_sec * 1000LL) + (now.tv_nsec / 1000000);
+}
+
+int main (int argc, const char **argv) {
+
+    int i;
+    for (i = 1; i < argc; ++i) {
+        if (!strncmp (argv[i], "-instance=", 10)) {
+            StatInstance = argv[i] + 10;
+        } else if (!strncmp (argv[i], "-interval=", 10)) {
+            StatInterval = atoi (argv[i] + 10);
+            if (StatInterval < 1) StatInterval = 1;
+        } else if (!strcmp (argv[i], "-once")) {
+            StatOnce = 1;
+        } else {
+            fprintf (stderr, "usage: housecgistat [-instance=NAME] "
+                             "[-interval=N] [-once]\n");
+            return 1;
+        }
+    }
+    if (!stat_open ()) return 1;
+
+    long long previous = 0;
+    for (;;) {
+        long long timestamp = stat_now();
+        stat_read (&StatCurrent);
+        if (!StatOnce) printf ("\033[H\033[2J"); // Clear the screen.
+        stat_show ((timestamp - previous) / 1000.0);
+        fflush (stdout);
+        if (StatOnce) break;
+
+        StatPrevious = StatCurrent;
+        StatHasPrevious = 1;
+        previous = timestamp;
+        sleep (StatInterval);
+    }
+    return 0;
+}
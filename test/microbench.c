@@ -0,0 +1,362 @@
+/* HouseCGI - A simple home web service to support CGI applications.
+ *
+ * Copyright 2025, Pascal Martin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ * microbench.c - Measure the housecgi hot paths in isolation.
+ *
+ * This program is linked with the housecgi modules and a stub of the
+ * echttp API (see the stub directory), so that it runs without network,
+ * HousePortal or the echttp library. It measures:
+ * - the decoding of a typical CGI header,
+ * - the construction of the CGI environment,
+ * - the route lookup when there are thousands of CGI applications,
+ * - the buffering of a large CGI output, both with a pipe and with
+ *   a memory file (memfd option),
+ * - the git info/refs request, with and without the git cache (only
+ *   if git is installed).
+ * - a full git clone, with and without the CGI store.
+ *
+ * Usage: microbench [-apps=N] [-count=N] [-size=N]
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "echttp.h"
+
+#include "housecgi_breaker.h"
+#include "housecgi_execute.h"
+#include "housecgi_route.h"
+#include "housecgi_schedule.h"
+#include "housecgi_warmup.h"
+#include "housecgi_worker.h"
+
+static char BenchRoot[] = "/tmp/housecgi-bench.XXXXXX";
+
+static long long bench_now (void) {
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return (now.tv_sec * 1000000000LL) + now.tv_nsec;
+}
+
+static void bench_report (const char *name,
+                          long long start, int count, long long bytes) {
+    long long elapsed = bench_now() - start;
+    printf ("%-28s %12.1f ns/op %10d ops", name, (double)elapsed / count, count);
+    if (bytes > 0)
+        printf (" %10.1f MB/s", (bytes * 1000.0) / elapsed);
+    printf ("\n");
+}
+
+static void bench_header (int count) {
+
+    static const char header[] =
+        "Content-Type: text/html; charset=UTF-8\r\n"
+        "Last-Modified: Sat, 18 Oct 2025 10:12:43 GMT\r\n"
+        "Expires: Sat, 18 Oct 2025 10:17:43 GMT\r\n"
+        "Cache-Control: no-cache, max-age=0, must-revalidate\r\n"
+        "ETag: \"bd3f4b6cc23b47a9d8d63e5e3c2d8f2e\"\r\n"
+        "Status: 200 OK\r\n"
+        "\r\n"
+        "<!DOCTYPE html>\n";
+    char buffer[sizeof(header)];
+
+    int i;
+    long long start = bench_now();
+    for (i = 0; i < count; ++i) {
+        memcpy (buffer, header, sizeof(header));
+        housecgi_execute_header (buffer, sizeof(header) - 1);
+    }
+    bench_report ("header decoding", start, count, 0);
+}
+
+static void bench_setenv (const char *name, const char *value) {
+    setenv (name, value, 1);
+}
+
+static void bench_unsetenv (const char *name, const char *value) {
+    unsetenv (name);
+}
+
+static void bench_environment (int count) {
+
+    echttp_stub_reset ();
+    echttp_stub_request ("Content-Type", "application/x-git-upload-pack-request");
+    echttp_stub_request ("Content-Length", "1234");
+    echttp_stub_request ("User-Agent", "git/2.39.5");
+    echttp_stub_request ("Cookie", "session=0123456789abcdef");
+    echttp_stub_request ("QUERY", "service=git-upload-pack");
+
+    int i;
+    long long start = bench_now();
+    for (i = 0; i < count; ++i) {
+        housecgi_execute_variables ("/githttp/cgi",
+                                    "/usr/local/share/house/public/githttp",
+                                    "POST",
+                                    "/githttp/cgi/housecgi/git-upload-pack",
+                                    bench_setenv);
+    }
+    bench_report ("environment construction", start, count, 0);
+
+    // Do not leak these variables to the CGI children run later.
+    housecgi_execute_variables ("/githttp/cgi",
+                                "/usr/local/share/house/public/githttp",
+                                "POST",
+                                "/githttp/cgi/housecgi/git-upload-pack",
+                                bench_unsetenv);
+    echttp_stub_reset ();
+}
+
+static void bench_route (int count, int apps) {
+
+    echttp_callback *handler = echttp_stub_route ();
+    if (!handler) return;
+
+    // This URI does not match any application, which is the worst case:
+    // the whole list of applications is searched.
+    int i;
+    long long start = bench_now();
+    for (i = 0; i < count; ++i) {
+        handler ("GET", "/nosuchapp/cgi/index.html", "", 0);
+    }
+    char title[64];
+    snprintf (title, sizeof(title), "route lookup (%d apps)", apps);
+    bench_report (title, start, count, 0);
+}
+
+static void bench_output (const char *name, int count, int size) {
+
+    echttp_callback *handler = echttp_stub_route ();
+    if (!handler) return;
+
+    char uri[128];
+    snprintf (uri, sizeof(uri), "/%s/cgi", name);
+
+    int i;
+    long long start = bench_now();
+    for (i = 0; i < count; ++i) {
+        handler ("GET", uri, "", 0);
+    }
+    char title[64];
+    snprintf (title, sizeof(title), "output %s (%d KB)", name, size / 1024);
+    bench_report (title, start, count, (long long)size * count);
+}
+
+static void bench_git (int count) {
+
+    echttp_callback *handler = echttp_stub_route ();
+    if (!handler) return;
+
+    echttp_stub_reset ();
+    echttp_stub_request ("QUERY", "service=git-upload-pack");
+
+    static const char uri[] = "/githttp/cgi/bench.git/info/refs";
+    char path[256];
+    snprintf (path, sizeof(path), "%s/git/bench.git/refs/bench", BenchRoot);
+
+    // Force a cache miss each time by touching the refs directory.
+    int i;
+    long long start = bench_now();
+    for (i = 0; i < count; ++i) {
+        close (open (path, O_WRONLY|O_CREAT, 0644));
+        unlink (path);
+        echttp_stub_listen ();
+        handler ("GET", uri, "", 0);
+    }
+    bench_report ("git info/refs (no cache)", start, count, 0);
+
+    handler ("GET", uri, "", 0); // Make sure this is in the cache.
+    start = bench_now();
+    for (i = 0; i < count * 100; ++i) {
+        handler ("GET", uri, "", 0);
+    }
+    bench_report ("git info/refs (cached)", start, count * 100, 0);
+    echttp_stub_reset ();
+}
+
+static void bench_clone (int count) {
+
+    echttp_callback *handler = echttp_stub_route ();
+    if (!handler) return;
+
+    char command[256];
+    char head[64] = {0};
+    snprintf (command, sizeof(command),
+              "git --git-dir=%s/git/bench.git rev-parse HEAD", BenchRoot);
+    FILE *f = popen (command, "r");
+    if (!f) return;
+    int valid = (fgets (head, sizeof(head), f) != 0);
+    pclose (f);
+    if (!valid) return;
+    head[40] = 0;
+
+    // A protocol v0 full clone: one want, no have.
+    char body[128];
+    int length = snprintf (body, sizeof(body),
+                           "003ewant %s no-progress\n00000009done\n", head);
+    char size[16];
+    snprintf (size, sizeof(size), "%d", length);
+
+    echttp_stub_reset ();
+    echttp_stub_request ("Content-Type", "application/x-git-upload-pack-request");
+    echttp_stub_request ("Content-Length", size);
+
+    static const char uri[] = "/githttp/cgi/bench.git/git-upload-pack";
+    char path[256];
+    snprintf (path, sizeof(path), "%s/git/bench.git/refs/bench", BenchRoot);
+
+    // Force a cache miss each time by touching the refs directory.
+    int i;
+    long long start = bench_now();
+    for (i = 0; i < count; ++i) {
+        close (open (path, O_WRONLY|O_CREAT, 0644));
+        unlink (path);
+        echttp_stub_listen ();
+        handler ("POST", uri, body, length);
+    }
+    bench_report ("git clone (no cache)", start, count, 0);
+
+    handler ("POST", uri, body, length); // Make sure this is in the store.
+    start = bench_now();
+    for (i = 0; i < count * 10; ++i) {
+        handler ("POST", uri, body, length);
+    }
+    bench_report ("git clone (stored)", start, count * 10, 0);
+    echttp_stub_reset ();
+}
+
+static void bench_create (const char *name, const char *content) {
+
+    char path[256];
+    snprintf (path, sizeof(path), "%s/%s", BenchRoot, name);
+    FILE *f = fopen (path, "w");
+    if (!f) return;
+    fputs (content, f);
+    fclose (f);
+    chmod (path, 0755);
+}
+
+static void bench_cleanup (int apps) {
+
+    char path[256];
+    int i;
+    for (i = 0; i < apps; ++i) {
+        snprintf (path, sizeof(path), "%s/app%05d", BenchRoot, i);
+        unlink (path);
+    }
+    snprintf (path, sizeof(path), "%s/pipe", BenchRoot);
+    unlink (path);
+    snprintf (path, sizeof(path), "%s/memfd", BenchRoot);
+    unlink (path);
+    snprintf (path, sizeof(path), "%s/githttp", BenchRoot);
+    unlink (path);
+    snprintf (path, sizeof(path), "rm -rf %s/git %s/store", BenchRoot, BenchRoot);
+    system (path);
+    rmdir (BenchRoot);
+}
+
+int main (int argc, const char **argv) {
+
+    int apps = 2000;
+    int count = 1000000;
+    int size = 1024 * 1024;
+
+    int i;
+    const char *value;
+    for (i = 1; i < argc; ++i) {
+        if (echttp_option_match ("-apps=", argv[i], &value)) {
+            apps = atoi (value);
+        } else if (echttp_option_match ("-count=", argv[i], &value)) {
+            count = atoi (value);
+        } else if (echttp_option_match ("-size=", argv[i], &value)) {
+            size = atoi (value);
+        }
+    }
+    if (count < 100) count = 100;
+
+    if (!mkdtemp (BenchRoot)) {
+        fprintf (stderr, "Cannot create %s\n", BenchRoot);
+        return 1;
+    }
+
+    // The applications used for route lookup are never executed.
+    for (i = 0; i < apps; ++i) {
+        char name[32];
+        snprintf (name, sizeof(name), "app%05d", i);
+        bench_create (name, "#!/bin/sh\nexit 0\n");
+    }
+    char script[1024];
+    snprintf (script, sizeof(script),
+              "#!/bin/sh\n"
+              "printf 'Content-Type: application/octet-stream\\r\\n\\r\\n'\n"
+              "exec head -c %d /dev/zero\n", size);
+    bench_create ("pipe", script);
+    bench_create ("memfd", script);
+
+    // The git repository contains one commit of 1 MB of random data.
+    snprintf (script, sizeof(script),
+              "cd %s && mkdir git && cd git && git init -q work && "
+              "head -c 1048576 /dev/urandom > work/data && "
+              "git -C work add data && "
+              "git -C work -c user.name=bench -c user.email=bench@localhost "
+              "commit -q -m bench && "
+              "git clone -q --bare work bench.git && rm -rf work", BenchRoot);
+    int git = (system (script) == 0);
+    if (git) {
+        snprintf (script, sizeof(script),
+                  "#!/bin/sh\n"
+                  "export GIT_HTTP_EXPORT_ALL=1\n"
+                  "export GIT_PROJECT_ROOT=%s/git\n"
+                  "exec git http-backend\n", BenchRoot);
+        bench_create ("githttp", script);
+    }
+
+    char binoption[256];
+    snprintf (binoption, sizeof(binoption), "-cgi-bin=%s", BenchRoot);
+    char gitoption[256];
+    snprintf (gitoption, sizeof(gitoption),
+              "-cgi-option=githttp:gitroot=%s/git,memfd", BenchRoot);
+    char storeoption[256];
+    snprintf (storeoption, sizeof(storeoption),
+              "-cgi-store=%s/store", BenchRoot);
+    const char *options[] = {
+        "microbench", binoption, "-cgi-option=memfd:memfd", gitoption,
+        storeoption, 0
+    };
+    housecgi_schedule_initialize (5, options);
+    housecgi_breaker_initialize (5, options);
+    housecgi_warmup_initialize (5, options);
+    housecgi_worker_initialize (5, options);
+    housecgi_route_initialize ("bench", 5, options);
+
+    bench_header (count);
+    bench_environment (count / 10);
+    bench_route (count / 100, apps);
+    bench_output ("pipe", 50, size);
+    bench_output ("memfd", 50, size);
+    if (git) bench_git (50);
+    if (git) bench_clone (20);
+
+    bench_cleanup (apps);
+    return 0;
+}
@@ -0,0 +1,63 @@
+/* HouseCGI - A simple home web service to support CGI applications.
+ *
+ * Copyright 2025, Pascal Martin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ * echttp.h - Stub of the echttp API, used by the micro-benchmark only.
+ */
+
+typedef void echttp_listener (int fd, int mode);
+
+typedef const char *echttp_callback (const char *method, const char *uri,
+                                     const char *data, int length);
+
+int echttp_port (int ip);
+int echttp_server_socket (int ip);
+
+int  echttp_route_uri (const char *uri, echttp_callback *call);
+int  echttp_route_match (const char *root, echttp_callback *call);
+void echttp_route_remove (const char *uri);
+
+int echttp_client_socket (void);
+
+const char *echttp_attribute_get (const char *name);
+void echttp_attribute_set (const char *name, const char *value);
+const char *echttp_parameter_get (const char *name);
+void echttp_parameter_join (char *text, int size);
+
+void echttp_content_type_html (void);
+void echttp_content_type_json (void);
+void echttp_content_length (int length);
+void echttp_content_queue (void *data, int length);
+void echttp_transfer (int fd, int size);
+
+void echttp_listen (int fd, int mode, echttp_listener *listener, int premium);
+
+void echttp_error (int code, const char *message);
+void echttp_redirect (const char *url);
+
+int echttp_option_match (const char *reference,
+                         const char *input, const char **value);
+int echttp_option_present (const char *reference, const char *input);
+
+// Stub specific functions, used to drive the stub from the benchmark.
+//
+echttp_callback *echttp_stub_route (void);
+void echttp_stub_request (const char *name, const char *value);
+int  echttp_stub_status (void);
+void echttp_stub_reset (void);
+void echttp_stub_listen (void);
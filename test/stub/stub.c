@@ -0,0 +1,210 @@
+/* HouseCGI - A simple home web service to support CGI applications.
+ *
+ * Copyright 2025, Pascal Martin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ *
+ * stub.c - A minimal stub of the echttp, houseportal and houselog APIs.
+ *
+ * This stub implements just enough of these APIs for the housecgi modules
+ * to run in a micro-benchmark, without any network or event loop. There is
+ * only one "current request", which attributes are set by the benchmark.
+ * The response data is discarded.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "echttp.h"
+#include "echttp_hash.h"
+#include "echttp_libc.h"
+#include "houseportalclient.h"
+#include "houselog.h"
+
+#define STUB_MAX 16
+
+static struct {
+    const char *name;
+    const char *value;
+} StubRequest[STUB_MAX];
+static int StubRequestCount = 0;
+
+static int StubStatus = 200;
+
+// Only the last prefix route declared is kept: all housecgi CGI routes
+// share the same handler anyway.
+static echttp_callback *StubRoute = 0;
+
+int echttp_port (int ip) {
+    return 80;
+}
+
+int echttp_server_socket (int ip) {
+    return -1; // There is no real server.
+}
+
+int echttp_route_uri (const char *uri, echttp_callback *call) {
+    return 0;
+}
+
+int echttp_route_match (const char *root, echttp_callback *call) {
+    StubRoute = call;
+    return 0;
+}
+
+void echttp_route_remove (const char *uri) { }
+
+const char *echttp_attribute_get (const char *name) {
+    int i;
+    for (i = 0; i < StubRequestCount; ++i) {
+        if (!strcmp (StubRequest[i].name, name)) return StubRequest[i].value;
+    }
+    return 0;
+}
+
+void echttp_attribute_set (const char *name, const char *value) { }
+
+int echttp_client_socket (void) {
+    return -1; // There is no real client.
+}
+
+const char *echttp_parameter_get (const char *name) {
+
+    static char value[256];
+    const char *query = echttp_attribute_get ("QUERY");
+    if (!query) return 0;
+
+    int length = strlen (name);
+    while (query) {
+        if ((!strncmp (query, name, length)) && (query[length] == '=')) {
+            const char *end = strchr (query, '&');
+            int size = end ? end - query - length - 1 : strlen (query+length+1);
+            if (size >= sizeof(value)) size = sizeof(value) - 1;
+            memcpy (value, query + length + 1, size);
+            value[size] = 0;
+            return value;
+        }
+        query = strchr (query, '&');
+        if (query) query += 1;
+    }
+    return 0;
+}
+
+void echttp_parameter_join (char *text, int size) {
+    const char *query = echttp_attribute_get ("QUERY");
+    snprintf (text, size, "%s", query ? query : "");
+}
+
+void echttp_content_type_html (void) { }
+void echttp_content_type_json (void) { }
+void echttp_content_length (int length) { }
+
+void echttp_content_queue (void *data, int length) {
+    free (data);
+}
+
+void echttp_transfer (int fd, int size) {
+    close (fd);
+}
+
+// The stub has no event loop: the listener is kept so that the
+// benchmark can call it.
+//
+static echttp_listener *StubListener = 0;
+static int StubListenerFd = -1;
+
+void echttp_listen (int fd, int mode, echttp_listener *listener, int premium) {
+    StubListener = listener;
+    StubListenerFd = fd;
+}
+
+void echttp_error (int code, const char *message) {
+    StubStatus = code;
+}
+
+void echttp_redirect (const char *url) {
+    StubStatus = 302;
+}
+
+int echttp_option_match (const char *reference,
+                         const char *input, const char **value) {
+    size_t length = strlen (reference);
+    if (strncmp (reference, input, length)) return 0;
+    *value = input + length;
+    return 1;
+}
+
+int echttp_option_present (const char *reference, const char *input) {
+    return !strcmp (reference, input);
+}
+
+long long echttp_hash_signature (const char *s) {
+    unsigned long long hash = 14695981039346656037ULL; // FNV-1a.
+    while (*s) {
+        hash ^= (unsigned char)(*(s++));
+        hash *= 1099511628211ULL;
+    }
+    return (long long)hash;
+}
+
+char *stpecpy (char *dst, char *end, const char *src) {
+    if (!dst) return 0;
+    while ((dst < end - 1) && *src) *(dst++) = *(src++);
+    *dst = 0;
+    return (*src) ? 0 : dst;
+}
+
+char *strtcpy (char *dst, const char *src, size_t size) {
+    if (size <= 0) return dst;
+    strncpy (dst, src, size - 1);
+    dst[size - 1] = 0;
+    return dst;
+}
+
+void houseportal_declare (int port, const char **names, int count) { }
+void houseportal_declare_more (int port, const char **names, int count) { }
+
+void houselog_event (const char *category,
+                     const char *object,
+                     const char *action,
+                     const char *format, ...) { }
+
+echttp_callback *echttp_stub_route (void) {
+    return StubRoute;
+}
+
+void echttp_stub_request (const char *name, const char *value) {
+    if (StubRequestCount < STUB_MAX) {
+        StubRequest[StubRequestCount].name = name;
+        StubRequest[StubRequestCount].value = value;
+        StubRequestCount += 1;
+    }
+}
+
+int echttp_stub_status (void) {
+    return StubStatus;
+}
+
+void echttp_stub_reset (void) {
+    StubRequestCount = 0;
+    StubStatus = 200;
+}
+
+void echttp_stub_listen (void) {
+    if (StubListener) StubListener (StubListenerFd, 1);
+}